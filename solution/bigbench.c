@@ -0,0 +1,100 @@
+// Large file benchmark.
+// Writes a file of several megabytes sequentially, fsync()s it,
+// then reads it back twice and removes it.  A file that size
+// reaches well into the double-indirect blocks and does not fit
+// in the block cache, so the reads go to the disk.  Reports for
+// each phase the throughput and how many blocks each disk
+// command moved on average.
+//
+// usage: bigbench [megabytes]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "fsstat.h"
+
+#define NMB  4
+#define CHUNK 4096
+
+char buf[CHUNK];
+
+void
+report(char *what, int kb, int ticks, struct fsstat *before, struct fsstat *after)
+{
+  uint cmds, blocks;
+
+  cmds = after->diskcmds - before->diskcmds;
+  blocks = after->diskblocks - before->diskblocks;
+  printf(1, "bigbench: %s: %d KB in %d ticks", what, kb, ticks);
+  if(ticks > 0)
+    printf(1, ", %d KB per tick", kb / ticks);
+  printf(1, "\n");
+  printf(1, "bigbench: %s: %d disk commands for %d blocks", what, cmds, blocks);
+  if(cmds > 0)
+    printf(1, ", %d.%d blocks per command", blocks / cmds,
+           blocks * 10 / cmds % 10);
+  printf(1, "\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct fsstat before, after;
+  int i, n, fd, nmb, nchunk, start, pass;
+
+  nmb = NMB;
+  if(argc > 1)
+    nmb = atoi(argv[1]);
+  nchunk = nmb * 1024 * 1024 / CHUNK;
+  if(nchunk > MAXFILE / (CHUNK / BSIZE)){
+    nchunk = MAXFILE / (CHUNK / BSIZE);
+    printf(1, "bigbench: files are at most %d KB\n", nchunk * CHUNK / 1024);
+  }
+
+  if(getfsstat(&before) < 0){
+    printf(1, "bigbench: getfsstat failed\n");
+    exit();
+  }
+
+  start = uptime();
+  if((fd = open("bigbench.tmp", O_CREATE | O_RDWR)) < 0){
+    printf(1, "bigbench: cannot create bigbench.tmp\n");
+    exit();
+  }
+  for(i = 0; i < nchunk; i++){
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, CHUNK) != CHUNK){
+      printf(1, "bigbench: write failed at chunk %d\n", i);
+      unlink("bigbench.tmp");
+      exit();
+    }
+  }
+  fsync(fd);
+  close(fd);
+  getfsstat(&after);
+  report("write", nchunk * (CHUNK / 1024), uptime() - start, &before, &after);
+
+  for(pass = 0; pass < 2; pass++){
+    before = after;
+    start = uptime();
+    if((fd = open("bigbench.tmp", O_RDONLY)) < 0){
+      printf(1, "bigbench: cannot open bigbench.tmp\n");
+      exit();
+    }
+    for(i = 0; (n = read(fd, buf, CHUNK)) == CHUNK; i++){
+      if(((int*)buf)[0] != i){
+        printf(1, "bigbench: chunk %d reads back as %d\n", i, ((int*)buf)[0]);
+        break;
+      }
+    }
+    close(fd);
+    getfsstat(&after);
+    report(pass == 0 ? "read" : "reread", i * (CHUNK / 1024),
+           uptime() - start, &before, &after);
+  }
+
+  unlink("bigbench.tmp");
+  exit();
+}
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,83 +12,193 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * To start reading a block that will be needed soon
+//     without waiting for it, call bread_async.
 //
 // The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Buffers are hashed by (dev, blockno) into BHASH buckets, each
+// with its own lock, so lookups of different blocks do not contend.
+// The number of buffers is chosen at boot from the amount of free
+// memory.  All buffers also sit on one circular list that a CLOCK
+// hand sweeps to pick a buffer to recycle on a miss: a buffer used
+// since the hand last passed gets a second chance.  Misses are
+// serialized by bcache.lock, which is the only path that moves a
+// buffer between buckets and so may hold two bucket locks.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "memstat.h"
+#include "fsstat.h"
 
-struct {
+#define BHASH 1021  // hash buckets, a prime
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;   // chain through hnext
+  uint nhit;          // lookups that found the block cached
+  uint nra;           // reads started by bread_async()
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;  // serializes misses and the clock hand
+  struct buf *hand;      // next buffer the clock looks at
+  int nbuf;
+  uint nmiss;            // lookups that had to recycle a buffer
+  uint nevict;           // valid blocks dropped to make room
+  struct bucket bucket[BHASH];
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % BHASH];
+}
+
+// Allocate the buffers: 1/BCACHEDIV of free memory, but at least
+// NBUF and at most NBUFMAX buffers.  Must run after kinit2().
 void
 binit(void)
 {
-  struct buf *b;
+  struct memstat ms;
+  struct buf *b, *last;
+  struct bucket *bk;
+  char *page;
+  int i, perpage, n;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < &bcache.bucket[BHASH]; bk++)
+    initlock(&bk->lock, "bcache.bucket");
+
+  kmemstat(&ms);
+  perpage = PGSIZE / sizeof(struct buf);
+  n = ms.freepages / BCACHEDIV * perpage;
+  if(n < NBUF)
+    n = NBUF;
+  if(n > NBUFMAX)
+    n = NBUFMAX;
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // Carve buffers out of whole pages and link them into
+  // the clock ring.  Unused buffers have no block and
+  // live in bucket 0 until first recycled.
+  last = 0;
+  bk = &bcache.bucket[0];
+  while(bcache.nbuf < n){
+    if((page = kalloc()) == 0)
+      break;
+    b = (struct buf*)page;
+    for(i = 0; i < perpage && bcache.nbuf < n; i++, b++){
+      memset(b, 0, sizeof(*b));
+      initsleeplock(&b->lock, "buffer");
+      b->blockno = ~0;
+      b->hnext = bk->head;
+      bk->head = b;
+      if(last)
+        last->next = b;
+      else
+        bcache.hand = b;
+      last = b;
+      bcache.nbuf++;
+    }
   }
+  if(bcache.nbuf < NBUF)
+    panic("binit: no memory");
+  last->next = bcache.hand;
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
-// In either case, return locked buffer.
-static struct buf*
+// In either case, return locked buffer, without reading the
+// block: B_VALID says whether b->data holds it.  A caller that
+// will overwrite all of b->data can use bget() instead of bread().
+struct buf*
 bget(uint dev, uint blockno)
 {
-  struct buf *b;
+  struct bucket *bk, *vk;
+  struct buf *b, **pp;
+  int i;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head; b; b = b->hnext){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
+      b->used = 1;
+      bk->nhit++;
+      release(&bk->lock);
       acquiresleep(&b->lock);
       return b;
     }
   }
+  release(&bk->lock);
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
+  // Not cached.  Look again under bcache.lock, since another
+  // CPU may have brought the block in meanwhile, then recycle
+  // an unused buffer.  Even if refcnt==0, B_DIRTY indicates a
+  // buffer is in use because log.c has modified it but not
+  // yet committed it.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  for(b = bk->head; b; b = b->hnext){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      b->used = 1;
+      bk->nhit++;
+      release(&bk->lock);
       release(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
     }
   }
+
+  for(i = 0; i < 2*bcache.nbuf; i++){
+    b = bcache.hand;
+    bcache.hand = b->next;
+    // Only bget() changes a buffer's identity, under
+    // bcache.lock, so its bucket cannot change under us.
+    vk = b->blockno == ~0 ? &bcache.bucket[0] : bhash(b->dev, b->blockno);
+    if(vk != bk)
+      acquire(&vk->lock);
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+      if(b->used){
+        b->used = 0;
+      } else {
+        for(pp = &vk->head; *pp != b; pp = &(*pp)->hnext)
+          ;
+        *pp = b->hnext;
+        if(vk != bk)
+          release(&vk->lock);
+        if(b->flags & B_VALID)
+          bcache.nevict++;
+        bcache.nmiss++;
+        b->dev = dev;
+        b->blockno = blockno;
+        b->flags = 0;
+        b->refcnt = 1;
+        b->used = 1;
+        b->hnext = bk->head;
+        bk->head = b;
+        release(&bk->lock);
+        release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
+    }
+    if(vk != bk)
+      release(&vk->lock);
+  }
   panic("bget: no buffers");
 }
 
@@ -105,6 +215,54 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading the indicated block into the cache, if it is not
+// there already, without waiting for the read to finish.  The disk
+// driver releases the buffer with bdone() once the data is in.
+void
+bread_async(uint dev, uint blockno)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  for(b = bk->head; b; b = b->hnext){
+    if(b->dev == dev && b->blockno == blockno){
+      release(&bk->lock);
+      return;
+    }
+  }
+  release(&bk->lock);
+
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  acquire(&bk->lock);
+  bk->nra++;
+  release(&bk->lock);
+  b->flags |= B_ASYNC;
+  iderw(b);
+}
+
+// Release a buffer whose bread_async() read has finished.
+// Called by the disk driver, possibly from its interrupt
+// handler, in place of the brelse() by the reader.
+void
+bdone(struct buf *b)
+{
+  struct bucket *bk;
+
+  b->flags &= ~B_ASYNC;
+  releasesleep(&b->lock);
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  release(&bk->lock);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -116,29 +274,41 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the MRU list.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
+  release(&bk->lock);
+}
+
+// Fill in buffer cache statistics for getfsstat().
+// Bucket counters are read without their locks, so the
+// totals are only a snapshot.
+void
+bstat(struct fsstat *fs)
+{
+  struct bucket *bk;
+
+  acquire(&bcache.lock);
+  fs->nbuf = bcache.nbuf;
+  fs->bmisses = bcache.nmiss;
+  fs->bevicts = bcache.nevict;
   release(&bcache.lock);
+  fs->bhits = 0;
+  fs->readahead = 0;
+  for(bk = bcache.bucket; bk < &bcache.bucket[BHASH]; bk++){
+    fs->bhits += bk->nhit;
+    fs->readahead += bk->nra;
+  }
 }
 //PAGEBREAK!
 // Blank page.
-
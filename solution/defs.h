@@ -1,20 +1,31 @@
 struct buf;
 struct context;
 struct file;
+struct fsstat;
 struct inode;
+struct kmem_cache;
+struct memstat;
 struct pipe;
 struct proc;
+struct pstat;
 struct rtcdate;
 struct spinlock;
+struct shmseg;
 struct sleeplock;
+struct spawnfd;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
+struct buf*     bget(uint, uint);
 struct buf*     bread(uint, uint);
+void            bread_async(uint, uint);
+void            bdone(struct buf*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bstat(struct fsstat*);
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +35,7 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -36,10 +48,15 @@ int             filewrite(struct file*, char*, int n);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
+void            ballocstat(struct fsstat*);
+void            dcachestat(struct fsstat*);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dirunlink(struct inode*, char*, uint);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            icacheinit(void);
+void            icachestat(struct fsstat*);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -54,9 +71,11 @@ void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
 // ide.c
+extern int      ideirq;
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idestat(struct fsstat*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -65,9 +84,17 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kalloc_zeroed(void);
+char*           kallocpages(int);
 void            kfree(char*);
+void            kfreepages(char*, int);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kmemstat(struct memstat*);
+void            kref(char*);
+int             kunref(char*);
+int             krefcount(char*);
+void            kzeroidle(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -86,11 +113,32 @@ void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+void            log_sync(void);
+void            logstat(struct fsstat*);
+
+// mmap.c
+struct vma*     findvma(struct proc*, uint);
+int             inmmap(struct proc*, uint, uint);
+int             mmap(uint, int, int, struct file*, uint);
+uint            mmapbase(struct proc*);
+int             mmapcopy(struct proc*, struct proc*);
+int             mmapfault(struct proc*, struct vma*, uint, uint);
+void            mmapinit(void);
+int             mmapshm(struct shmseg*, uint);
+int             munmap(uint, uint);
+void            munmapall(struct proc*);
 
 // mp.c
 extern int      ismp;
 void            mpinit(void);
 
+// pci.c
+struct pcidev;
+int             pcifind(ushort, ushort, uchar, uchar, struct pcidev*);
+void            pcienable(struct pcidev*);
+uint            pciread(struct pcidev*, int);
+void            pciwrite(struct pcidev*, int, uint);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -98,6 +146,7 @@ void            picinit(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
+void            pipeinit(void);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
@@ -108,14 +157,18 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+void            kthread(char*, void (*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
 void            procdump(void);
+int             procstat(struct pstat*, int);
+int             pstatsize(int);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
+int             spawn(char*, char**, struct spawnfd*, int);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
@@ -124,6 +177,16 @@ void            yield(void);
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// shm.c
+int             shmat(int);
+void            shmdup(struct shmseg*);
+int             shmdt(uint);
+void            shmexit(struct proc*);
+int             shmget(int, uint);
+void            shminit(void);
+char*           shmpage(struct shmseg*, uint);
+void            shmput(struct shmseg*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -133,6 +196,12 @@ void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// slab.c
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            kmem_cache_init(struct kmem_cache*, char*, uint, void(*)(void*));
+int             slabpages(void);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -151,6 +220,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argwptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -181,7 +251,17 @@ void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+int             pagefault(uint, uint);
+int             residentuvm(pde_t*, uint, uint);
+int             ptpages(pde_t*);
+int             faultin(uint, uint);
+int             writableuvm(uint, uint);
+int             sharepages(pde_t*, pde_t*, uint, uint, int);
+pte_t*          walkpgdir(pde_t*, const void*, int);
+int             mappages(pde_t*, void*, uint, uint, int);
 void            switchuvm(struct proc*);
+void            lazyswitchuvm(struct proc*);
+void            vmstat(struct memstat*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
@@ -0,0 +1,122 @@
+// Large directory benchmark.
+// Creates many empty files in a new directory, opens each of
+// them and a name that is not there, then removes them all.
+// Reports for each phase how long it took, how many buffer
+// cache lookups each name cost, and how the name cache did.
+// Build the kernel with DIR_LINEAR=1 to compare hashed
+// directories with linear ones.
+//
+// usage: dirbench [files]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fsstat.h"
+
+#define NFILE 10000
+
+void
+name(char *path, char c, int i)
+{
+  char digits[8];
+  int n;
+
+  n = 0;
+  do {
+    digits[n++] = '0' + i % 10;
+    i /= 10;
+  } while(i > 0);
+  *path++ = c;
+  while(n > 0)
+    *path++ = digits[--n];
+  *path = 0;
+}
+
+void
+report(char *what, int nfile, int ticks, struct fsstat *before, struct fsstat *after)
+{
+  uint lookups;
+
+  lookups = (after->bhits - before->bhits) + (after->bmisses - before->bmisses);
+  printf(1, "dirbench: %s: %d names in %d ticks, %d block lookups per name, "
+         "%d disk blocks\n", what, nfile, ticks, lookups / nfile,
+         after->diskblocks - before->diskblocks);
+  printf(1, "dirbench: %s: name cache %d hits, %d missing, %d misses\n", what,
+         after->dhits - before->dhits, after->dnegative - before->dnegative,
+         after->dmisses - before->dmisses);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct fsstat before, after;
+  int i, fd, nfile, start;
+  char path[16];
+
+  nfile = NFILE;
+  if(argc > 1)
+    nfile = atoi(argv[1]);
+  if(nfile < 1)
+    nfile = 1;
+
+  if(mkdir("dirbench.d") < 0 || chdir("dirbench.d") < 0){
+    printf(1, "dirbench: cannot make dirbench.d\n");
+    exit();
+  }
+  if(getfsstat(&before) < 0){
+    printf(1, "dirbench: getfsstat failed\n");
+    exit();
+  }
+
+  start = uptime();
+  for(i = 0; i < nfile; i++){
+    name(path, 'f', i);
+    if((fd = open(path, O_CREATE | O_RDWR)) < 0){
+      printf(1, "dirbench: cannot create %s\n", path);
+      nfile = i;
+      break;
+    }
+    close(fd);
+  }
+  getfsstat(&after);
+  report("create", nfile, uptime() - start, &before, &after);
+
+  before = after;
+  start = uptime();
+  for(i = 0; i < nfile; i++){
+    name(path, 'f', i);
+    if((fd = open(path, O_RDONLY)) < 0){
+      printf(1, "dirbench: cannot open %s\n", path);
+      break;
+    }
+    close(fd);
+  }
+  getfsstat(&after);
+  report("lookup", nfile, uptime() - start, &before, &after);
+
+  before = after;
+  start = uptime();
+  for(i = 0; i < nfile; i++){
+    name(path, 'm', i);
+    if((fd = open(path, O_RDONLY)) >= 0){
+      printf(1, "dirbench: found %s\n", path);
+      close(fd);
+    }
+  }
+  getfsstat(&after);
+  report("missing", nfile, uptime() - start, &before, &after);
+
+  before = after;
+  start = uptime();
+  for(i = 0; i < nfile; i++){
+    name(path, 'f', i);
+    unlink(path);
+  }
+  getfsstat(&after);
+  report("unlink", nfile, uptime() - start, &before, &after);
+
+  chdir("..");
+  unlink("dirbench.d");
+  exit();
+}
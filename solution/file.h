@@ -14,6 +14,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // icache hash chain, protected by icache.lock
+  struct inode *prev; // icache LRU list, when ref is 0
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -22,7 +25,18 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  // last run of blocks bmap() found contiguous on disk
+  uint extbn;         // first file block of the run
+  uint extaddr;       // its disk block
+  uint extlen;        // blocks in the run, 0 if none
+  uint goal;          // disk block balloc() tries first, 0 if none
+
+  // read-ahead state, see readahead() in fs.c
+  uint ranext;        // block a sequential read would start in
+  uint rawin;         // current read-ahead window, in blocks
+  uint rahead;        // blocks before this have been read ahead
 };
 
 // table mapping major device number to
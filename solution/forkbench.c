@@ -0,0 +1,99 @@
+// Fork storm benchmark.
+// Starts several workers that each grow a heap, then fork and
+// reap children as fast as they can. Each child writes one
+// page of the heap before exiting. Reports pages allocated per
+// fork, which copy-on-write keeps proportional to the pages
+// actually written, and how often the page allocator had to
+// take its global lock per page allocated.
+//
+// usage: forkbench [workers [forks-per-worker [heap-pages]]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "memstat.h"
+
+#define NWORKER 4
+#define NFORK   50
+#define NHEAP   64
+
+void
+worker(int nfork, int nheap)
+{
+  int i, pid;
+  char *heap;
+
+  if((heap = sbrk(nheap * 4096)) == (char*)-1){
+    printf(1, "forkbench: sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < nheap; i++)
+    heap[i * 4096] = i;
+
+  for(i = 0; i < nfork; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "forkbench: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      if(nheap > 0)
+        heap[(i % nheap) * 4096] = 0;
+      exit();
+    }
+    wait();
+  }
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat before, after;
+  int i, nworker, nfork, nheap, start, elapsed;
+  uint pages, locks;
+
+  nworker = NWORKER;
+  nfork = NFORK;
+  nheap = NHEAP;
+  if(argc > 1)
+    nworker = atoi(argv[1]);
+  if(argc > 2)
+    nfork = atoi(argv[2]);
+  if(argc > 3)
+    nheap = atoi(argv[3]);
+
+  if(getmemstat(&before) < 0){
+    printf(1, "forkbench: getmemstat failed\n");
+    exit();
+  }
+  start = uptime();
+
+  for(i = 0; i < nworker; i++){
+    if(fork() == 0)
+      worker(nfork, nheap);
+  }
+  for(i = 0; i < nworker; i++)
+    wait();
+
+  elapsed = uptime() - start;
+  getmemstat(&after);
+
+  pages = after.allocs - before.allocs;
+  locks = after.lockacq - before.lockacq;
+  printf(1, "forkbench: %d workers x %d forks with %d heap pages in %d ticks\n",
+         nworker, nfork, nheap, elapsed);
+  printf(1, "forkbench: %d pages allocated, %d allocator lock acquisitions\n",
+         pages, locks);
+  if(nworker * nfork > 0)
+    printf(1, "forkbench: %d pages allocated per fork\n",
+           pages / (nworker * nfork));
+  if(pages > 0)
+    printf(1, "forkbench: %d lock acquisitions per 1000 pages\n",
+           locks * 1000 / pages);
+  printf(1, "forkbench: %d free pages, %d in per-CPU caches, %d pre-zeroed\n",
+         after.freepages, after.cachedpages, after.zeropages);
+  printf(1, "forkbench: %d zeroed allocations from pool, %d zeroed synchronously\n",
+         after.zerohits - before.zerohits, after.zeromisses - before.zeromisses);
+  exit();
+}
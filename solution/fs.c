@@ -20,9 +20,14 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "slab.h"
+#include "fsstat.h"
+#include "memstat.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void dcacheinit(void);
+static void dcachepurge(uint, uint);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -51,32 +56,158 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// balloc() starts looking for a free block at a goal: the block
+// after the file's last allocation, so that a file's blocks end
+// up consecutive, or else where the last search left off, so
+// that the bitmap is not rescanned from the start every time.
+// A file that allocates keeps a window of the BRESERVE blocks
+// past its last one reserved, in memory only, and other files
+// allocate around those windows while there is room elsewhere;
+// that keeps files written at the same time from interleaving.
+
+#define NRESERVE 16   // files with reserved windows
+
+struct reserve {
+  uint inum;          // file the window is for, 0 if none
+  uint start;         // first block of the window
+};
+
+struct {
+  struct spinlock lock;
+  uint cursor;        // where searches without a goal start
+  uint next;          // window to take when all are in use
+  struct reserve rsv[NRESERVE];
+  uint nalloc;        // blocks allocated
+  uint ngoal;         // of those, at the file's goal
+  uint nnozero;       // of those, not zeroed
+} alloc;
+
+// Is block b in a window reserved for a file other than inum?
+static int
+reserved(uint inum, uint b)
+{
+  struct reserve *r;
+  int found;
+
+  found = 0;
+  acquire(&alloc.lock);
+  for(r = alloc.rsv; r < &alloc.rsv[NRESERVE]; r++)
+    if(r->inum && r->inum != inum && b - r->start < BRESERVE)
+      found = 1;
+  release(&alloc.lock);
+  return found;
+}
+
+// Move file inum's window to just past block b.
+// Caller holds alloc.lock.
+static void
+reserve(uint inum, uint b)
+{
+  struct reserve *r, *free;
+
+  free = 0;
+  for(r = alloc.rsv; r < &alloc.rsv[NRESERVE]; r++){
+    if(r->inum == inum)
+      break;
+    if(r->inum == 0 && free == 0)
+      free = r;
+  }
+  if(r == &alloc.rsv[NRESERVE]){
+    r = free ? free : &alloc.rsv[alloc.next++ % NRESERVE];
+    r->inum = inum;
+  }
+  r->start = b + 1;
+}
+
+// Drop file inum's window.
+static void
+unreserve(uint inum)
+{
+  struct reserve *r;
 
-// Allocate a zeroed disk block.
+  acquire(&alloc.lock);
+  for(r = alloc.rsv; r < &alloc.rsv[NRESERVE]; r++)
+    if(r->inum == inum)
+      r->inum = 0;
+  release(&alloc.lock);
+}
+
+// Allocate a disk block for ip, zeroed unless zero is 0 because
+// the caller will overwrite all of it.  Searches from ip->goal,
+// first around other files' windows, then anywhere.
 static uint
-balloc(uint dev)
+balloc(struct inode *ip, int zero)
 {
-  int b, bi, m;
+  uint b, bi, m, n, start, goal;
   struct buf *bp;
-
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+  int pass;
+
+  start = sb.size - sb.nblocks;  // first data block
+  acquire(&alloc.lock);
+  goal = ip->goal;
+  if(goal < start || goal >= sb.size)
+    goal = alloc.cursor;
+  release(&alloc.lock);
+
+  for(pass = 0; pass < 2; pass++){
+    bp = 0;
+    b = goal;
+    for(n = 0; n < sb.nblocks; n++, b++){
+      if(b >= sb.size)
+        b = start;
+      if(bp == 0 || bp->blockno != BBLOCK(b, sb)){
+        if(bp)
+          brelse(bp);
+        bp = bread(ip->dev, BBLOCK(b, sb));
       }
+      bi = b % BPB;
+      if(bi % 8 == 0 && bp->data[bi/8] == 0xff && b + 8 <= sb.size){
+        b += 7;  // skip a byte of used blocks
+        n += 7;
+        continue;
+      }
+      m = 1 << (bi % 8);
+      if((bp->data[bi/8] & m) != 0)  // Is block in use?
+        continue;
+      if(pass == 0 && reserved(ip->inum, b))
+        continue;
+      bp->data[bi/8] |= m;  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+
+      acquire(&alloc.lock);
+      alloc.nalloc++;
+      if(b == ip->goal)
+        alloc.ngoal++;
+      if(!zero)
+        alloc.nnozero++;
+      alloc.cursor = b + 1;
+      ip->goal = b + 1;
+      reserve(ip->inum, b);
+      release(&alloc.lock);
+
+      if(zero)
+        bzero(ip->dev, b);
+      return b;
     }
-    brelse(bp);
+    if(bp)
+      brelse(bp);
   }
   panic("balloc: out of blocks");
 }
 
+// Fill in block allocation statistics for getfsstat().
+void
+ballocstat(struct fsstat *fs)
+{
+  acquire(&alloc.lock);
+  fs->allocs = alloc.nalloc;
+  fs->allocgoal = alloc.ngoal;
+  fs->allocnozero = alloc.nnozero;
+  release(&alloc.lock);
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -119,18 +250,23 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() finds or creates a cache
+//   entry and increments its ref; iput() decrements ref.
+//   An entry whose ref reaches zero stays cached, valid,
+//   on an LRU list, so that the next iget() of it needs no
+//   disk read; iget() recycles the least recently used such
+//   entry once the cache has icache.max entries.  Entries
+//   come from a slab cache, and more than icache.max can be
+//   in use at a time, so only memory limits how many inodes
+//   can be referenced.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -155,30 +291,105 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// entries, the hash table and the LRU list. Since ip->ref indicates
+// whether an entry is in use, and ip->dev and ip->inum indicate which
+// i-node an entry holds, one must hold icache.lock while using any
+// of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 251
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH]; // all entries, by (dev, inum)
+  struct inode lru;     // entries with ref 0, most recently used first
+  int n;                // entries allocated
+  int max;              // entries to keep
+  uint nhit;            // iget()s that found the inode cached
+  uint nmiss;           // iget()s that had to set up an entry
+  uint inext;           // last inode ialloc() allocated, a hint
+  struct kmem_cache cache;
 } icache;
 
+static void
+inodector(void *obj)
+{
+  struct inode *ip = obj;
+
+  initsleeplock(&ip->lock, "inode");
+}
+
+// Set up the inode cache to keep 1/ICACHEDIV of free memory's
+// worth of inodes, but at least NINODE and at most NINODEMAX.
+// Called from main() since userinit() looks up "/" before
+// iinit() runs; must run after kinit2().
 void
-iinit(int dev)
+icacheinit(void)
 {
-  int i = 0;
-  
+  struct memstat ms;
+
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
+  kmem_cache_init(&icache.cache, "icache", sizeof(struct inode), inodector);
+  icache.lru.prev = &icache.lru;
+  icache.lru.next = &icache.lru;
+  kmemstat(&ms);
+  icache.max = ms.freepages / ICACHEDIV * (PGSIZE / sizeof(struct inode));
+  if(icache.max < NINODE)
+    icache.max = NINODE;
+  if(icache.max > NINODEMAX)
+    icache.max = NINODEMAX;
+  dcacheinit();
+}
+
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &icache.hash[(dev*31 + inum) % NIHASH];
+}
+
+// Take ip out of the hash table.  Caller must hold icache.lock.
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = ihash(ip->dev, ip->inum); *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      break;
+    }
   }
+}
+
+// Take ip, which has ref 0, off the LRU list.
+// Caller must hold icache.lock.
+static void
+ilruremove(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// Fill in inode cache statistics for getfsstat().
+void
+icachestat(struct fsstat *fs)
+{
+  acquire(&icache.lock);
+  fs->ninode = icache.n;
+  fs->ihits = icache.nhit;
+  fs->imisses = icache.nmiss;
+  release(&icache.lock);
+}
 
+void
+iinit(int dev)
+{
   readsb(dev, &sb);
+  initlock(&alloc.lock, "alloc");
+  alloc.cursor = sb.size - sb.nblocks;
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
@@ -194,11 +405,15 @@ static struct inode* iget(uint dev, uint inum);
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  int inum, n;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
+  // Start where the last allocation left off.
+  for(n = 1; n < sb.ninodes; n++){
+    inum = icache.inext + n;
+    if(inum >= sb.ninodes)
+      inum -= sb.ninodes - 1;
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
@@ -206,6 +421,7 @@ ialloc(uint dev, short type)
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
+      icache.inext = inum;
       return iget(dev, inum);
     }
     brelse(bp);
@@ -241,31 +457,49 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = *ihash(dev, inum); ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        ilruremove(ip);
+      icache.nhit++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
-
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  icache.nmiss++;
+
+  // Allocate a new inode cache entry, or recycle the least
+  // recently used unreferenced one if the cache is full.
+  ip = 0;
+  if(icache.n < icache.max)
+    ip = kmem_cache_alloc(&icache.cache);
+  if(ip)
+    icache.n++;
+  else if(icache.lru.prev != &icache.lru){
+    ip = icache.lru.prev;
+    ilruremove(ip);
+    iunhash(ip);
+  } else if((ip = kmem_cache_alloc(&icache.cache)) != 0)
+    icache.n++;
+  else
     panic("iget: no inodes");
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = 0;
+  ip->rawin = 0;
+  ip->rahead = 0;
+  ip->extlen = 0;
+  ip->goal = 0;
+  ip->hnext = *ihash(dev, inum);
+  *ihash(dev, inum) = ip;
   release(&icache.lock);
 
   return ip;
@@ -322,8 +556,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry is
+// freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -338,6 +572,8 @@ iput(struct inode *ip)
     release(&icache.lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcachepurge(ip->dev, ip->inum);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
@@ -347,7 +583,20 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    unreserve(ip->inum);
+    if(icache.n > icache.max){
+      // Over the limit while many inodes were in use.
+      iunhash(ip);
+      icache.n--;
+      kmem_cache_free(&icache.cache, ip);
+    } else {
+      ip->next = icache.lru.next;
+      ip->prev = &icache.lru;
+      icache.lru.next->prev = ip;
+      icache.lru.next = ip;
+    }
+  }
   release(&icache.lock);
 }
 
@@ -367,38 +616,128 @@ iunlockput(struct inode *ip)
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
 // listed in block ip->addrs[NDIRECT].
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// Remember that file blocks bn, bn+1, ... of ip are at disk
+// blocks a[0], a[1], ... for as long as those are consecutive.
+// a holds the n remaining entries of the block map bn is in.
+// Returns a[0].
 static uint
-bmap(struct inode *ip, uint bn)
+extent(struct inode *ip, uint bn, uint *a, uint n)
 {
-  uint addr, *a;
+  uint i;
+
+  for(i = 1; i < n && a[i] == a[0] + i; i++)
+    ;
+  ip->extbn = bn;
+  ip->extaddr = a[0];
+  ip->extlen = i;
+  return a[0];
+}
+
+// Allocate a disk block for file block bn of ip, growing the
+// remembered run if the new block continues it.
+static uint
+bmapalloc(struct inode *ip, uint bn, int zero)
+{
+  uint addr;
+
+  addr = balloc(ip, zero);
+  if(ip->extlen && bn == ip->extbn + ip->extlen &&
+     addr == ip->extaddr + ip->extlen){
+    ip->extlen++;
+  } else {
+    ip->extbn = bn;
+    ip->extaddr = addr;
+    ip->extlen = 1;
+  }
+  return addr;
+}
+
+// Return entry i of the indirect block at addr, allocating a
+// block for it if it has none.  If data is set, the entry is
+// file block bn, allocated as bmap() says; otherwise addr is a
+// double-indirect block and the entry is an indirect block.
+static uint
+bmapind(struct inode *ip, uint addr, uint i, uint bn, int data, int zero)
+{
+  uint *a;
   struct buf *bp;
 
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    a[i] = addr = data ? bmapalloc(ip, bn, zero) : balloc(ip, 1);
+    log_write(bp);
+  } else if(data){
+    extent(ip, bn, a + i, NINDIRECT - i);
+  }
+  brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one, zeroed unless
+// zero is 0 because the caller will overwrite all of it.
+// Each lookup remembers the run of consecutive disk blocks that
+// starts there, as far as the same block map goes, so sequential
+// access reads each indirect block once per run, not per block.
+static uint
+bmap(struct inode *ip, uint bn, int zero)
+{
+  uint addr, fbn;
+
+  if(ip->extlen && bn - ip->extbn < ip->extlen)
+    return ip->extaddr + (bn - ip->extbn);
+
+  fbn = bn;
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
+    if(ip->addrs[bn] == 0)
+      return ip->addrs[bn] = bmapalloc(ip, fbn, zero);
+    return extent(ip, fbn, ip->addrs + bn, NDIRECT - bn);
   }
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+      ip->addrs[NDIRECT] = addr = balloc(ip, 1);
+    return bmapind(ip, addr, bn, fbn, 1, zero);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load double-indirect block, then the indirect block.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip, 1);
+    addr = bmapind(ip, addr, bn / NINDIRECT, 0, 0, 1);
+    return bmapind(ip, addr, bn % NINDIRECT, fbn, 1, zero);
   }
 
   panic("bmap: out of range");
 }
 
+// Free the indirect block at addr and the blocks it points to.
+// If depth is 2, those are indirect blocks to free in turn.
+static void
+itruncind(struct inode *ip, uint addr, int depth)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      itruncind(ip, a[j], depth - 1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -407,9 +746,7 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -418,19 +755,17 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < 2; i++){
+    if(ip->addrs[NDIRECT+i]){
+      itruncind(ip, ip->addrs[NDIRECT+i], i+1);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
   ip->size = 0;
+  ip->extlen = 0;
+  ip->goal = 0;
+  unreserve(ip->inum);
   iupdate(ip);
 }
 
@@ -446,6 +781,41 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Read-ahead for sequential readers.  A read of ip that starts in
+// the block where the previous one ended is sequential: it grows
+// ip's read-ahead window, doubling it up to READAHEAD blocks, and
+// starts reading the blocks of the window that have not been read
+// ahead yet.  Any other read closes the window.  first and end are
+// the offsets of the first byte read and just past the last.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint first, uint end)
+{
+  uint bn, last;
+
+  if(first/BSIZE == ip->ranext){
+    if(ip->rawin == 0)
+      ip->rawin = 4;
+    else if(ip->rawin < READAHEAD)
+      ip->rawin *= 2;
+  } else {
+    ip->rawin = 0;
+    ip->rahead = 0;
+  }
+  ip->ranext = end/BSIZE;
+  if(ip->rawin == 0)
+    return;
+
+  last = ip->ranext + ip->rawin;
+  if(last > (ip->size + BSIZE - 1)/BSIZE)
+    last = (ip->size + BSIZE - 1)/BSIZE;
+  bn = ip->rahead > ip->ranext ? ip->rahead : ip->ranext;
+  for(; bn < last; bn++)
+    bread_async(ip->dev, bmap(ip, bn, 1));
+  if(bn > ip->rahead)
+    ip->rahead = bn;
+}
+
 //PAGEBREAK!
 // Read data from inode.
 // Caller must hold ip->lock.
@@ -467,11 +837,13 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bp = bread(ip->dev, bmap(ip, off/BSIZE, 1));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
   }
+  if(n > 0)
+    readahead(ip, off - n, off);
   return n;
 }
 
@@ -495,9 +867,18 @@ writei(struct inode *ip, char *src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  // Continue the file's layout from its last block.
+  if(ip->goal == 0 && ip->size > 0)
+    ip->goal = bmap(ip, (ip->size - 1)/BSIZE, 1) + 1;
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(m == BSIZE){
+      // Overwriting all of the block: don't zero or read it.
+      bp = bget(ip->dev, bmap(ip, off/BSIZE, 0));
+      bp->flags |= B_VALID;
+    } else
+      bp = bread(ip->dev, bmap(ip, off/BSIZE, 1));
     memmove(bp->data + off%BSIZE, src, m);
     log_write(bp);
     brelse(bp);
@@ -519,32 +900,525 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Name cache.
+//
+// Remembers the results of directory lookups: for a directory
+// and a name, the inode number and offset of the entry, or that
+// there is no such entry.  dirlookup() looks here first, and
+// dirlink() and dirunlink() keep the cache up to date, so a
+// cached answer is always right.  All of them hold the
+// directory's lock, which orders a directory's cache updates.
+// Entries are hashed on (dev, directory, name) and recycled in
+// least recently used order.
+
+#define NDHASH 127
+
+struct dentry {
+  uint dev;
+  uint dir;             // directory's inode number, 0 if unused
+  char name[DIRSIZ];
+  uint inum;            // 0 if dir has no entry called name
+  uint off;             // byte offset of the entry in dir
+  struct dentry *hnext; // hash chain
+  struct dentry *prev;  // LRU list, most recently used first
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+  struct dentry head;
+  uint nhit;            // lookups answered with an inode
+  uint nneg;            // lookups answered with no such name
+  uint nmiss;           // lookups that read the directory
+} dcache;
+
+static void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+static struct dentry**
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev*31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + (uchar)name[i];
+  return &dcache.hash[h % NDHASH];
+}
+
+// Find the entry for name in directory dir and make it the most
+// recently used.  Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dhash(dev, dir, name); d; d = d->hnext){
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0){
+      d->next->prev = d->prev;
+      d->prev->next = d->next;
+      d->next = dcache.head.next;
+      d->prev = &dcache.head;
+      dcache.head.next->prev = d;
+      dcache.head.next = d;
+      return d;
+    }
+  }
+  return 0;
+}
+
+// Take d out of its hash chain.  Caller must hold dcache.lock.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dhash(d->dev, d->dir, d->name); *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->dir = 0;
+}
+
+// Record that name in dp is inode inum at offset off,
+// or, if inum is 0, that dp has no entry called name.
+// Caller must hold dp->lock.
+static void
+dcacheput(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d, **pp;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    // Recycle the least recently used entry.
+    d = dcache.head.prev;
+    if(d->dir)
+      dunhash(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    pp = dhash(d->dev, d->dir, d->name);
+    d->hnext = *pp;
+    *pp = d;
+    d->next->prev = d->prev;
+    d->prev->next = d->next;
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  release(&dcache.lock);
+}
+
+// Forget the entries of directory inode inum, which is being freed.
+static void
+dcachepurge(uint dev, uint inum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++)
+    if(d->dir == inum && d->dev == dev)
+      dunhash(d);
+  release(&dcache.lock);
+}
+
+// Fill in name cache statistics for getfsstat().
+void
+dcachestat(struct fsstat *fs)
+{
+  acquire(&dcache.lock);
+  fs->dhits = dcache.nhit;
+  fs->dnegative = dcache.nneg;
+  fs->dmisses = dcache.nmiss;
+  release(&dcache.lock);
+}
+
+// Hashed directories, see fs.h.
+// A linear directory becomes hashed when a new entry does not
+// fit in its first block, unless the kernel is built with
+// DIR_LINEAR=1.  Reorganizing moves entries, so it drops the
+// directory's name cache entries.  A hashed directory stays
+// hashed.
+#ifdef DIR_LINEAR
+#define DXCONVERT 0
+#else
+#define DXCONVERT 1
+#endif
+
+// Hash of a directory entry name.  mkfs.c has a copy.
+static uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+static void
+dxget(struct dxslot *s, int i, uint *hash, uint *blk)
+{
+  *hash = s[i/2].hash[i%2];
+  *blk = s[i/2].blk[i%2];
+}
+
+static void
+dxset(struct dxslot *s, int i, uint hash, uint blk)
+{
+  s[i/2].hash[i%2] = hash;
+  s[i/2].blk[i%2] = blk;
+}
+
+// Number of entries in use in the index s of max entries.
+static int
+dxcount(struct dxslot *s, int max)
+{
+  int i;
+
+  for(i = 0; i < max && s[i/2].blk[i%2]; i++)
+    ;
+  return i;
+}
+
+// The entry of the n in index s whose range holds hash h.
+static int
+dxfind(struct dxslot *s, int n, uint h)
+{
+  int i;
+
+  for(i = 1; i < n && s[i/2].hash[i%2] <= h; i++)
+    ;
+  return i - 1;
+}
+
+// Insert an entry at position at in index s, which has n.
+static void
+dxinsert(struct dxslot *s, int n, int at, uint hash, uint blk)
+{
+  uint h, b;
+  int i;
+
+  for(i = n; i > at; i--){
+    dxget(s, i-1, &h, &b);
+    dxset(s, i, h, b);
+  }
+  dxset(s, at, hash, blk);
+}
+
+// Return a locked buf for block fbn of directory dp.
+static struct buf*
+dirblock(struct inode *dp, uint fbn)
+{
+  return bread(dp->dev, bmap(dp, fbn, 1));
+}
+
+// Add a zeroed block to the end of directory dp and return it,
+// locked, setting *fbn to its block number.  Caller must iupdate().
+static struct buf*
+dirgrow(struct inode *dp, uint *fbn)
+{
+  *fbn = dp->size / BSIZE;
+  dp->size = (*fbn + 1) * BSIZE;
+  return dirblock(dp, *fbn);
+}
+
+// Is bp, block 0 of a directory, the root of a hashed directory?
+static int
+dxroot(struct buf *bp)
+{
+  struct dxhead *hd = (struct dxhead*)bp->data + 2;
+
+  return hd->inum == 0 && hd->magic == DXMAGIC;
+}
+
+// Find the leaf block of hashed directory dp that holds hash h.
+static uint
+dxleaf(struct inode *dp, struct buf *bp0, uint h)
+{
+  struct dxslot *s;
+  struct buf *bp;
+  uint hash, blk;
+
+  s = (struct dxslot*)bp0->data + 3;
+  dxget(s, dxfind(s, dxcount(s, DXROOT), h), &hash, &blk);
+  bp = dirblock(dp, blk);
+  s = (struct dxslot*)bp->data;
+  dxget(s, dxfind(s, dxcount(s, DXINDEX), h), &hash, &blk);
+  brelse(bp);
+  return blk;
+}
+
+// Look for name among the first n dirents of bp, block fbn of
+// a directory.  Returns its inum, or 0.
+static uint
+direntscan(struct buf *bp, uint fbn, int n, char *name, uint *poff)
+{
+  struct dirent *de;
+  int i;
+
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < n; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      // entry matches path element
+      *poff = fbn*BSIZE + i*sizeof(*de);
+      return de[i].inum;
+    }
+  }
+  return 0;
+}
+
+// Look for name among the first n dirents of block fbn of dp.
+// Returns its inum, or 0.
+static uint
+dirscan(struct inode *dp, uint fbn, int n, char *name, uint *poff)
+{
+  struct buf *bp;
+  uint inum;
+
+  bp = dirblock(dp, fbn);
+  inum = direntscan(bp, fbn, n, name, poff);
+  brelse(bp);
+  return inum;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Caller must hold dp->lock.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint off, inum, fbn, n;
+  struct dentry *d;
+  struct buf *bp;
+  int hashed;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) != 0){
+    inum = d->inum;
+    off = d->off;
+    if(inum)
+      dcache.nhit++;
+    else
+      dcache.nneg++;
+    release(&dcache.lock);
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+  dcache.nmiss++;
+  release(&dcache.lock);
+
+  inum = 0;
+  off = 0;
+  hashed = 0;
+  if(dp->size >= BSIZE){
+    bp = dirblock(dp, 0);
+    // Block 0 is locked here, so scan . and .. in bp itself;
+    // leaves are never block 0.
+    if((hashed = dxroot(bp)) != 0){
+      if((inum = direntscan(bp, 0, 2, name, &off)) == 0)
+        inum = dirscan(dp, dxleaf(dp, bp, dxhash(name)), DXSLOTS, name, &off);
     }
+    brelse(bp);
+  }
+  for(fbn = 0; !hashed && inum == 0 && fbn*BSIZE < dp->size; fbn++){
+    n = dp->size - fbn*BSIZE;
+    if(n > BSIZE)
+      n = BSIZE;
+    inum = dirscan(dp, fbn, n / sizeof(struct dirent), name, &off);
   }
 
-  return 0;
+  dcacheput(dp, name, inum, off);
+  if(inum == 0)
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
+}
+
+// Turn dp, a linear directory whose only block is full, into a
+// hashed one with a single index block and a single leaf.
+static void
+dxconvert(struct inode *dp)
+{
+  struct buf *bp0, *bpi, *bpl;
+  struct dxhead *hd;
+  uint iblk, lblk;
+
+  bp0 = dirblock(dp, 0);
+  bpi = dirgrow(dp, &iblk);
+  bpl = dirgrow(dp, &lblk);
+
+  memmove(bpl->data, bp0->data + 2*sizeof(struct dirent),
+          BSIZE - 2*sizeof(struct dirent));
+  dxset((struct dxslot*)bpi->data, 0, 0, lblk);
+  memset(bp0->data + 2*sizeof(struct dirent), 0,
+         BSIZE - 2*sizeof(struct dirent));
+  hd = (struct dxhead*)bp0->data + 2;
+  hd->magic = DXMAGIC;
+  dxset((struct dxslot*)bp0->data + 3, 0, 0, iblk);
+
+  log_write(bpl);
+  log_write(bpi);
+  log_write(bp0);
+  brelse(bpl);
+  brelse(bpi);
+  brelse(bp0);
+  iupdate(dp);
+  dcachepurge(dp->dev, dp->inum);
+}
+
+// Add an entry to hashed directory dp, splitting its leaf, and
+// that leaf's index block, if they are full.  Returns the byte
+// offset of the new entry, or -1 if the root index is full too.
+// The worst case writes block 0, two index blocks, two leaves,
+// three indirect blocks to map the two new ones (the indirect
+// block, the double-indirect block and a new second-level
+// block, or the double-indirect block and two second-level
+// ones), two bitmap blocks and dp's inode: 11 blocks.
+// create() adds the new inode's block, and for mkdir its first
+// data block and maybe one more bitmap block, so MAXOPBLOCKS
+// is 14.
+static int
+dxlink(struct inode *dp, char *name, uint inum)
+{
+  struct buf *bp0, *bpi, *bpl, *bpn, *bpx;
+  struct dxslot *root, *idx;
+  struct dxslot *x;
+  struct dirent *de, t, ents[DXSLOTS+1];
+  uint h, hashes[DXSLOTS+1], hash, blk, iblk, lblk, nblk, xblk;
+  int i, j, k, n, nr, ni, ri, ii, off;
+
+  h = dxhash(name);
+  bp0 = dirblock(dp, 0);
+  root = (struct dxslot*)bp0->data + 3;
+  nr = dxcount(root, DXROOT);
+  ri = dxfind(root, nr, h);
+  dxget(root, ri, &hash, &iblk);
+  bpi = dirblock(dp, iblk);
+  idx = (struct dxslot*)bpi->data;
+  ni = dxcount(idx, DXINDEX);
+  ii = dxfind(idx, ni, h);
+  dxget(idx, ii, &hash, &lblk);
+  bpl = dirblock(dp, lblk);
+  de = (struct dirent*)bpl->data;
+
+  // Room in the leaf?
+  for(i = 0; i < DXSLOTS; i++){
+    if(de[i].inum == 0){
+      de[i].inum = inum;
+      strncpy(de[i].name, name, DIRSIZ);
+      log_write(bpl);
+      off = lblk*BSIZE + i*sizeof(*de);
+      goto done;
+    }
+  }
+
+  // Split the leaf at a hash that leaves about half the entries,
+  // including the new one, in each.
+  off = -1;
+  if(ni == DXINDEX && nr == DXROOT)
+    goto done;
+  n = 0;
+  for(i = 0; i <= DXSLOTS; i++){
+    if(i < DXSLOTS)
+      ents[n] = de[i];
+    else {
+      ents[n].inum = inum;
+      strncpy(ents[n].name, name, DIRSIZ);
+    }
+    hashes[n] = dxhash(ents[n].name);
+    for(j = n; j > 0 && hashes[j-1] > hashes[j]; j--){
+      hash = hashes[j];
+      hashes[j] = hashes[j-1];
+      hashes[j-1] = hash;
+      t = ents[j];
+      ents[j] = ents[j-1];
+      ents[j-1] = t;
+    }
+    n++;
+  }
+  for(k = n/2; k < n && hashes[k] == hashes[k-1]; k++)
+    ;
+  if(k == n)
+    for(k = n/2; k > 0 && hashes[k] == hashes[k-1]; k--)
+      ;
+  if(k == 0)
+    goto done;  // all one hash
+
+  bpn = dirgrow(dp, &nblk);
+  memset(bpl->data, 0, BSIZE);
+  memmove(bpl->data, ents, k*sizeof(*de));
+  memmove(bpn->data, ents + k, (n-k)*sizeof(*de));
+  for(i = 0; i < n && namecmp(ents[i].name, name) != 0; i++)
+    ;
+  off = i < k ? lblk*BSIZE + i*sizeof(*de) : nblk*BSIZE + (i-k)*sizeof(*de);
+  log_write(bpl);
+  log_write(bpn);
+  brelse(bpn);
+
+  // Index the new leaf, moving the upper half of a full
+  // index block to a new one.
+  if(ni == DXINDEX){
+    bpx = dirgrow(dp, &xblk);
+    x = (struct dxslot*)bpx->data;
+    for(i = DXINDEX/2; i < DXINDEX; i++){
+      dxget(idx, i, &hash, &blk);
+      dxset(x, i - DXINDEX/2, hash, blk);
+      dxset(idx, i, 0, 0);
+    }
+    dxget(x, 0, &hash, &blk);
+    dxinsert(root, nr, ri+1, hash, xblk);
+    if(ii+1 <= DXINDEX/2)
+      dxinsert(idx, DXINDEX/2, ii+1, hashes[k], nblk);
+    else
+      dxinsert(x, DXINDEX/2, ii+1 - DXINDEX/2, hashes[k], nblk);
+    log_write(bpx);
+    brelse(bpx);
+    log_write(bp0);
+  } else {
+    dxinsert(idx, ni, ii+1, hashes[k], nblk);
+  }
+  log_write(bpi);
+  iupdate(dp);
+  dcachepurge(dp->dev, dp->inum);
+
+done:
+  brelse(bpl);
+  brelse(bpi);
+  brelse(bp0);
+  return off;
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -554,6 +1428,8 @@ dirlink(struct inode *dp, char *name, uint inum)
   int off;
   struct dirent de;
   struct inode *ip;
+  struct buf *bp;
+  int hashed;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -561,22 +1437,59 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  hashed = 0;
+  if(dp->size >= BSIZE){
+    bp = dirblock(dp, 0);
+    hashed = dxroot(bp);
+    brelse(bp);
   }
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
+  if(hashed){
+    if((off = dxlink(dp, name, inum)) < 0)
+      return -1;
+  } else {
+    // Look for an empty dirent.
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if(de.inum == 0)
+        break;
+    }
+
+    if(DXCONVERT && off == BSIZE && dp->size == BSIZE){
+      // The only block is full: switch to hashing.  A linear
+      // directory that is already bigger (from mkfs, or a
+      // DIR_LINEAR kernel) stays linear.
+      dxconvert(dp);
+      if((off = dxlink(dp, name, inum)) < 0)
+        return -1;
+      dcacheput(dp, name, inum, off);
+      return 0;
+    }
+
+    strncpy(de.name, name, DIRSIZ);
+    de.inum = inum;
+    if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirlink");
+  }
+  dcacheput(dp, name, inum, off);
 
   return 0;
 }
 
+// Remove the entry for name, at byte offset off, from directory dp.
+// Caller must hold dp->lock.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+    panic("unlink: writei");
+  dcacheput(dp, name, 0, 0);
+}
+
 //PAGEBREAK!
 // Paths
 
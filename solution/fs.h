@@ -21,9 +21,14 @@ struct superblock {
   uint bmapstart;    // Block number of first free map block
 };
 
-#define NDIRECT 12
+// An inode maps its first NDIRECT blocks directly, the next
+// NINDIRECT through the indirect block addrs[NDIRECT], and the
+// next NDINDIRECT through the double-indirect block addrs[NDIRECT+1],
+// which holds the addresses of NINDIRECT more indirect blocks.
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -32,7 +37,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -55,3 +60,31 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Hashed directories.
+// A directory can instead be a two-level hash tree, like ext3's
+// htree.  Block 0 holds "." and "..", then a header, then the
+// root index, whose entries point to index blocks, whose entries
+// point to leaf blocks of ordinary dirents.  An index entry
+// covers the name hashes from its own up to the next entry's.
+// The header and index slots start with a zero inum, so reading
+// the directory as an array of dirents still works.
+#define DXMAGIC 0x7844  // "Dx"
+
+struct dxhead {
+  ushort inum;          // always 0
+  ushort magic;         // DXMAGIC
+  uint pad[3];
+};
+
+// Two index entries, packed into one dirent-sized slot.
+struct dxslot {
+  ushort inum;          // always 0
+  ushort blk[2];        // directory block, 0 if entry unused
+  ushort pad;
+  uint hash[2];         // first name hash the block holds
+};
+
+#define DXSLOTS  (BSIZE / sizeof(struct dirent))  // slots per block
+#define DXROOT   ((DXSLOTS - 3) * 2)  // root index entries in block 0
+#define DXINDEX  (DXSLOTS * 2)        // entries per index block
+
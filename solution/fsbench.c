@@ -0,0 +1,225 @@
+// File system benchmark.
+// First reads every file in / sequentially; right after boot
+// those blocks are not cached yet, which shows how much of a
+// cold sequential scan read-ahead turns into cache hits.  Then
+// writes a few files, rewrites the start of one with an fsync()
+// after every block, reads the files back twice, and looks up a
+// name that exists and one that does not over and over.
+// Reports for each phase how long it took and how the buffer
+// cache did: hits, misses, evictions, blocks read ahead and hit
+// rate, and how many disk commands moved how many blocks with
+// how many seeks, the disk queue's average depth and latency,
+// how often the inode cache had the inode, how many blocks
+// were allocated right after the file's previous block, and how
+// many system calls and disk writes and reads each log commit
+// carried.  Build the kernel with IDE_PIO=1 to compare
+// programmed I/O with DMA.
+//
+// usage: fsbench [files [blocks-per-file]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "fsstat.h"
+
+#define NFILE 4
+#define NBLK  64
+#define NSYNC 16
+#define NLOOKUP 500
+#define BLK   512
+
+char buf[BLK];
+
+void
+report(char *what, int ticks, struct fsstat *before, struct fsstat *after)
+{
+  uint hits, misses, blocks, ilookups, allocs, commits;
+
+  hits = after->bhits - before->bhits;
+  misses = after->bmisses - before->bmisses;
+  printf(1, "fsbench: %s: %d ticks, %d hits, %d misses, %d evictions, "
+         "%d read ahead", what, ticks, hits, misses,
+         after->bevicts - before->bevicts,
+         after->readahead - before->readahead);
+  if(hits + misses > 0)
+    printf(1, ", %d%% hit rate", hits * 100 / (hits + misses));
+  printf(1, "\n");
+  blocks = after->diskblocks - before->diskblocks;
+  printf(1, "fsbench: %s: %d disk commands for %d blocks, %d seeks", what,
+         after->diskcmds - before->diskcmds, blocks,
+         after->diskseeks - before->diskseeks);
+  if(blocks > 0)
+    printf(1, ", queue depth %d, %d ticks per 100 blocks",
+           (after->diskqsum - before->diskqsum) / blocks,
+           (after->disklat - before->disklat) * 100 / blocks);
+  printf(1, "\n");
+  ilookups = (after->ihits - before->ihits) + (after->imisses - before->imisses);
+  if(ilookups > 0)
+    printf(1, "fsbench: %s: %d inode lookups, %d%% cached, %d inodes in cache\n",
+           what, ilookups, (after->ihits - before->ihits) * 100 / ilookups,
+           after->ninode);
+  allocs = after->allocs - before->allocs;
+  if(allocs > 0)
+    printf(1, "fsbench: %s: %d blocks allocated, %d%% contiguous, "
+           "%d not zeroed\n", what, allocs,
+           (after->allocgoal - before->allocgoal) * 100 / allocs,
+           after->allocnozero - before->allocnozero);
+  commits = after->commits - before->commits;
+  if(commits == 0)
+    return;
+  printf(1, "fsbench: %s: %d commits, %d system calls per commit\n", what,
+         commits, (after->commitops - before->commitops) / commits);
+  printf(1, "fsbench: %s: per commit %d log writes, %d installs "
+         "(%d from copies), %d reads\n", what,
+         (after->logwrites - before->logwrites) / commits,
+         (after->installs - before->installs) / commits,
+         (after->installcopies - before->installcopies) / commits,
+         (after->commitreads - before->commitreads) / commits);
+}
+
+void
+name(char *path, int i)
+{
+  strcpy(path, "fsbench.0");
+  path[8] += i;
+}
+
+// Read every regular file in / from start to end.
+// Returns the number of bytes read.
+int
+scanroot(void)
+{
+  struct dirent de;
+  struct stat st;
+  int dfd, fd, n, tot;
+  char path[DIRSIZ+2];
+
+  tot = 0;
+  if((dfd = open("/", O_RDONLY)) < 0)
+    return 0;
+  while(read(dfd, &de, sizeof(de)) == sizeof(de)){
+    if(de.inum == 0)
+      continue;
+    path[0] = '/';
+    memmove(path+1, de.name, DIRSIZ);
+    path[DIRSIZ+1] = 0;
+    if((fd = open(path, O_RDONLY)) < 0)
+      continue;
+    if(fstat(fd, &st) == 0 && st.type == T_FILE)
+      while((n = read(fd, buf, sizeof(buf))) > 0)
+        tot += n;
+    close(fd);
+  }
+  close(dfd);
+  return tot;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct fsstat before, after;
+  int i, j, fd, nfile, nblk, start, pass, n, ticks;
+  char path[16];
+
+  nfile = NFILE;
+  nblk = NBLK;
+  if(argc > 1)
+    nfile = atoi(argv[1]);
+  if(argc > 2)
+    nblk = atoi(argv[2]);
+  if(nfile > 10)
+    nfile = 10;
+
+  if(getfsstat(&before) < 0){
+    printf(1, "fsbench: getfsstat failed\n");
+    exit();
+  }
+  printf(1, "fsbench: %d buffers in the block cache, disk uses %s\n",
+         before.nbuf, before.diskdma ? "DMA" : "PIO");
+
+  start = uptime();
+  n = scanroot();
+  ticks = uptime() - start;
+  getfsstat(&after);
+  report("scan /", ticks, &before, &after);
+  printf(1, "fsbench: scan /: %d KB", n / 1024);
+  if(ticks > 0)
+    printf(1, ", %d KB per tick", n / 1024 / ticks);
+  printf(1, "\n");
+
+  before = after;
+  start = uptime();
+  for(i = 0; i < nfile; i++){
+    name(path, i);
+    if((fd = open(path, O_CREATE | O_RDWR)) < 0){
+      printf(1, "fsbench: cannot create %s\n", path);
+      exit();
+    }
+    memset(buf, 'a' + i, sizeof(buf));
+    for(j = 0; j < nblk; j++){
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf(1, "fsbench: write %s failed\n", path);
+        exit();
+      }
+    }
+    close(fd);
+  }
+  getfsstat(&after);
+  report("write", uptime() - start, &before, &after);
+
+  before = after;
+  start = uptime();
+  name(path, 0);
+  if((fd = open(path, O_WRONLY)) < 0){
+    printf(1, "fsbench: cannot open %s\n", path);
+    exit();
+  }
+  for(j = 0; j < NSYNC; j++){
+    write(fd, buf, sizeof(buf));
+    fsync(fd);
+  }
+  close(fd);
+  getfsstat(&after);
+  report("fsync", uptime() - start, &before, &after);
+
+  for(pass = 0; pass < 2; pass++){
+    before = after;
+    start = uptime();
+    for(i = 0; i < nfile; i++){
+      name(path, i);
+      if((fd = open(path, O_RDONLY)) < 0){
+        printf(1, "fsbench: cannot open %s\n", path);
+        exit();
+      }
+      for(j = 0; j < nblk; j++)
+        read(fd, buf, sizeof(buf));
+      close(fd);
+    }
+    getfsstat(&after);
+    report(pass == 0 ? "read" : "reread", uptime() - start, &before, &after);
+  }
+
+  // Look up names the way sh does: a program that exists,
+  // and one that does not.
+  before = after;
+  start = uptime();
+  for(i = 0; i < NLOOKUP; i++){
+    if((fd = open("/cat", O_RDONLY)) >= 0)
+      close(fd);
+    open("/nosuchprogram", O_RDONLY);
+  }
+  getfsstat(&after);
+  report("lookup", uptime() - start, &before, &after);
+  printf(1, "fsbench: lookup: %d names, %d cached, %d cached as missing, "
+         "%d read from directories\n", 2 * NLOOKUP,
+         after.dhits - before.dhits, after.dnegative - before.dnegative,
+         after.dmisses - before.dmisses);
+
+  for(i = 0; i < nfile; i++){
+    name(path, i);
+    unlink(path);
+  }
+  exit();
+}
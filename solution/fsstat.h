@@ -0,0 +1,35 @@
+#ifndef __FSSTAT_H
+#define __FSSTAT_H
+
+// File system and buffer cache statistics,
+// filled in by getfsstat().
+struct fsstat {
+  uint nbuf;          // buffers in the block cache
+  uint bhits;         // block lookups that found the block cached
+  uint bmisses;       // block lookups that recycled a buffer
+  uint bevicts;       // cached blocks dropped to make room
+  uint readahead;     // blocks read ahead of sequential readers
+  uint diskdma;       // 1 if the disk driver uses DMA, 0 for PIO
+  uint diskcmds;      // commands issued to the disk
+  uint diskblocks;    // blocks transferred by those commands
+  uint diskseeks;     // commands not starting where the last one ended
+  uint diskqsum;      // sum of the queue depth found by each block
+  uint disklat;       // sum of ticks from queueing to done, per block
+  uint commits;       // log commits
+  uint commitops;     // FS system calls in those commits
+  uint logwrites;     // log and header blocks written by commits
+  uint installs;      // blocks commits wrote to their home locations
+  uint installcopies; // of those, written from the log copy
+  uint commitreads;   // blocks commits had to read from disk
+  uint allocs;        // blocks allocated
+  uint allocgoal;     // of those, right after the file's previous block
+  uint allocnozero;   // of those, not zeroed since they were overwritten
+  uint dhits;         // name lookups the name cache answered with an inode
+  uint dnegative;     // name lookups it answered with no such name
+  uint dmisses;       // name lookups that read the directory
+  uint ninode;        // entries in the inode cache
+  uint ihits;         // inode lookups that found the inode cached
+  uint imisses;       // inode lookups that set up a new entry
+};
+
+#endif
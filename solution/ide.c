@@ -1,4 +1,15 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.
+//
+// If the PCI IDE controller supports bus-master DMA (QEMU's PIIX
+// does), requests are transferred by DMA: the controller copies
+// the data to or from memory described by a table of physical
+// region descriptors while the CPU does other work.  Otherwise,
+// or when built with IDE_PIO, the CPU copies every word with
+// programmed I/O.
+//
+// Waiting requests are kept in C-LOOK elevator order, and one
+// command carries up to IDEMAXBLK queued requests for consecutive
+// blocks in the same direction.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +23,8 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
+#include "fsstat.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,15 +36,51 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
+// Bus-master registers, as offsets from bmbase.
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // device to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+#define IDEMAXBLK     8     // most blocks in one command
+
+// Physical region descriptor: one physically contiguous
+// piece of a DMA transfer.  May not cross a 64KB boundary.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last descriptor in the table
+
+// idequeue points to the buf now being read/written to the disk,
+// followed by the rest of the idenblk bufs in the same command.
+// The bufs after those are waiting to be processed, in the order
+// ideinsert() keeps them.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
 
+int ideirq = IRQ_IDE;      // interrupt line, for trap()
+
 static int havedisk1;
+static ushort bmbase;     // bus-master I/O base, or 0 to use PIO
+static struct prd *prdt;  // descriptor table for the active command
+static int idenblk;       // bufs at the head of idequeue in the command
+static uint idecmds;      // commands issued
+static uint ideblks;      // blocks transferred
+static uint idenext;      // block after the last command's
+static uint ideseeks;     // commands not starting at idenext
+static uint idedepth;     // bufs in idequeue
+static uint ideqsum;      // sum of idedepth seen by each new buf
+static uint idelat;       // sum of ticks from iderw() to done
 static void idestart(struct buf*);
 
 // Wait for IDE disk to become ready.
@@ -47,6 +96,28 @@ idewait(int checkerr)
   return 0;
 }
 
+// Find the PCI IDE controller and set it up for bus-master DMA.
+// Leaves bmbase zero, so that requests use PIO, if it cannot
+// or if the kernel was built with IDE_PIO.
+static void
+idedmainit(void)
+{
+  struct pcidev d;
+
+#ifdef IDE_PIO
+  return;
+#endif
+  if(pcifind(0, 0, PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &d) < 0)
+    return;
+  if((d.bar[4] & 1) == 0)  // bus-master registers not in I/O space
+    return;
+  if((prdt = (struct prd*)kalloc()) == 0)
+    return;
+  pcienable(&d);
+  bmbase = d.bar[4] & ~3;
+  cprintf("ide: bus-master DMA at 0x%x\n", bmbase);
+}
+
 void
 ideinit(void)
 {
@@ -67,12 +138,19 @@ ideinit(void)
 
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  idedmainit();
 }
 
 // Start the request for b.  Caller must hold idelock.
+// Also take along the bufs queued right behind b for the
+// following blocks in the same direction.
 static void
 idestart(struct buf *b)
 {
+  struct buf *q;
+  int i, n, write;
+
   if(b == 0)
     panic("idestart");
   if(b->blockno >= FSSIZE)
@@ -84,14 +162,44 @@ idestart(struct buf *b)
 
   if (sector_per_block > 7) panic("idestart");
 
+  // PIO moves one block per interrupt, which only lines
+  // up with sectors if a block is one sector.
+  write = b->flags & B_DIRTY;
+  for(n = 1, q = b; n < IDEMAXBLK && (bmbase || sector_per_block == 1); n++, q = q->qnext){
+    if(q->qnext == 0 || q->qnext->dev != b->dev ||
+       q->qnext->blockno != q->blockno + 1 ||
+       (q->qnext->flags & B_DIRTY) != write)
+      break;
+  }
+  if(bmbase){
+    for(i = 0, q = b; i < n; i++, q = q->qnext){
+      prdt[i].addr = V2P(q->data);
+      prdt[i].len = BSIZE;
+      prdt[i].flags = 0;
+    }
+    prdt[n-1].flags = PRD_EOT;
+  }
+  idenblk = n;
+  idecmds++;
+  ideblks += n;
+  if(b->blockno != idenext)
+    ideseeks++;
+  idenext = b->blockno + n;
+
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, n * sector_per_block);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(bmbase){
+    outl(bmbase+BM_PRDT, V2P(prdt));
+    outb(bmbase+BM_STATUS, BM_ST_ERR|BM_ST_INTR);  // write 1 to clear
+    outb(bmbase+BM_CMD, write ? 0 : BM_CMD_READ);
+    outb(0x1f7, write ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(bmbase+BM_CMD, (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+  } else if(write){
     outb(0x1f7, write_cmd);
     outsl(0x1f0, b->data, BSIZE/4);
   } else {
@@ -99,29 +207,72 @@ idestart(struct buf *b)
   }
 }
 
+// Mark b done, and wake the process waiting for it,
+// or release it if no one is.  Caller must hold idelock.
+static void
+idedone(struct buf *b)
+{
+  idedepth--;
+  idelat += ticks - b->qtime;
+  b->flags |= B_VALID;
+  b->flags &= ~B_DIRTY;
+  if(b->flags & B_ASYNC)
+    bdone(b);
+  else
+    wakeup(b);
+}
+
 // Interrupt handler.
 void
 ideintr(void)
 {
   struct buf *b;
+  int i, st;
 
-  // First queued buffer is the active request.
+  // First queued buffers are the active request.
   acquire(&idelock);
 
   if((b = idequeue) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(bmbase){
+    st = inb(bmbase+BM_STATUS);
+    outb(bmbase+BM_CMD, 0);
+    outb(bmbase+BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+    if((st & BM_ST_ERR) || idewait(1) < 0){
+      // Retry the command, and all later ones, with PIO.
+      cprintf("ide: DMA error, using PIO\n");
+      bmbase = 0;
+      idestart(b);
+      release(&idelock);
+      return;
+    }
+    for(i = 0; i < idenblk; i++){
+      b = idequeue;
+      idequeue = b->qnext;
+      idedone(b);
+    }
+  } else {
+    idequeue = b->qnext;
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Read data if needed.
+    if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+      insl(0x1f0, b->data, BSIZE/4);
+    idedone(b);
+
+    // The disk interrupts once per sector of a multi-sector
+    // command; hand it the next sector to write, if any.
+    if(--idenblk > 0){
+      if(idequeue->flags & B_DIRTY){
+        idewait(0);
+        outsl(0x1f0, idequeue->data, BSIZE/4);
+      }
+      release(&idelock);
+      return;
+    }
+  }
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
@@ -130,15 +281,46 @@ ideintr(void)
   release(&idelock);
 }
 
+// Insert b into idequeue in C-LOOK order.  The disk sweeps
+// upward in block number from the active command: behind that
+// command wait the requests at or above it in increasing order,
+// then those below it, in increasing order, for the next sweep.
+// Caller must hold idelock.
+static void
+ideinsert(struct buf *b)
+{
+  struct buf **pp;
+  uint pos;
+  int i;
+
+  ideqsum += idedepth++;
+  b->qtime = ticks;
+  pp = &idequeue;
+  if(idequeue){
+    pos = idequeue->blockno;
+    for(i = 0; i < idenblk; i++)
+      pp = &(*pp)->qnext;
+    for(; *pp; pp = &(*pp)->qnext){
+      if((b->blockno >= pos) != ((*pp)->blockno >= pos)){
+        if(b->blockno >= pos)
+          break;  // *pp waits for the next sweep
+      } else if(b->blockno < (*pp)->blockno)
+        break;
+    }
+  }
+  b->qnext = *pp;
+  *pp = b;
+}
+
 //PAGEBREAK!
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, return without waiting; ideintr() hands
+// the buf to bdone() when the read is done.
 void
 iderw(struct buf *b)
 {
-  struct buf **pp;
-
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
@@ -148,21 +330,31 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  ideinsert(b);  //DOC:insert-queue
 
   // Start disk if necessary.
   if(idequeue == b)
     idestart(b);
 
   // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+  while((b->flags & B_ASYNC) == 0 && (b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
 
 
   release(&idelock);
 }
+
+// Fill in disk statistics for getfsstat().
+void
+idestat(struct fsstat *fs)
+{
+  acquire(&idelock);
+  fs->diskdma = bmbase != 0;
+  fs->diskcmds = idecmds;
+  fs->diskblocks = ideblks;
+  fs->diskseeks = ideseeks;
+  fs->diskqsum = ideqsum;
+  fs->disklat = idelat;
+  release(&idelock);
+}
@@ -1,6 +1,22 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, or with
+// kallocpages() power-of-two runs of contiguous pages.
+//
+// Free pages are kept by a buddy allocator protected by
+// kmem.lock, fronted by a small per-CPU cache ("magazine") of
+// single pages that kalloc() and kfree() use with interrupts off
+// and without taking the lock. A CPU only takes the lock to move
+// KCACHEBATCH pages at a time: refilling an empty cache, or
+// draining one that has grown past KCACHEMAX.
+//
+// Each page handed out by kalloc() has a reference count, so that
+// copy-on-write fork can share user pages between processes;
+// kfree() only frees a page when its last reference goes away.
+//
+// Pages that must start out zeroed (page tables and user memory)
+// come from kalloc_zeroed(), which prefers a pool of pages that
+// idle CPUs zero ahead of time in kzeroidle().
 
 #include "types.h"
 #include "defs.h"
@@ -8,6 +24,13 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "memstat.h"
+
+#define KCACHEMAX   64  // most pages a CPU cache holds before draining
+#define KBATCHORDER  5  // a CPU cache refills with one 2^KBATCHORDER block
+#define KCACHEBATCH (1<<KBATCHORDER)  // pages moved per refill/drain
+#define ZPOOLMAX   256  // most pre-zeroed pages kept in the pool
+#define ZIDLEBATCH   8  // pages zeroed per call to kzeroidle()
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -15,23 +38,67 @@ extern char end[]; // first address after kernel loaded from ELF file
 
 struct run {
   struct run *next;
+  struct run *prev;  // only maintained on the buddy free lists
+};
+
+// Per-CPU page cache. Only touched by its own CPU,
+// with interrupts disabled.
+struct kcache {
+  struct run *freelist;
+  int n;          // pages on freelist
+  uint nalloc;    // pages handed out by kalloc() on this CPU
+  uint nfree;     // pages returned by kfree() on this CPU
+  uint nzhit;     // kalloc_zeroed() calls served from the zeroed pool
+  uint nzmiss;    // kalloc_zeroed() calls that zeroed synchronously
 };
 
+// The global free memory is managed by a binary buddy allocator.
+// A free block of order k is 2^k pages, aligned to its own size
+// in physical memory, and sits on freelist[k]. The buddy of a
+// block is the block of the same order whose physical address
+// differs only in bit (PGSIZE<<k); when both are free they are
+// merged into one block of order k+1.
+//
+// pgorder[] records, for the first page of every free block,
+// its order plus one, and is zero for all other pages. This is
+// how buddyfree() tells whether a buddy is free to merge with.
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *freelist[KMAXORDER+1];
+  int nblock[KMAXORDER+1];  // blocks on each freelist
+  int nfree;      // pages on the buddy free lists
+  uint nlock;     // acquisitions of lock
+  uint nalloc;    // pages handed out by kallocpages() for order > 0
+  uint nfreed;    // pages returned by kfreepages() for order > 0
+  struct kcache cache[NCPU];
 } kmem;
 
+static uchar pgorder[PHYSTOP/PGSIZE];
+
+// Reference counts of allocated pages, indexed by physical page number.
+// Updated with atomic instructions rather than under a lock.
+static ushort pgref[PHYSTOP/PGSIZE];
+
+// Pool of pages zeroed by idle CPUs, handed out by kalloc_zeroed().
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;          // pages on freelist
+} zpool;
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// The per-CPU caches are only used once use_lock is set, since
+// before that cpuid() does not work yet.
 void
 kinit1(void *vstart, void *vend)
 {
   initlock(&kmem.lock, "kmem");
+  initlock(&zpool.lock, "zpool");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -40,6 +107,7 @@ void
 kinit2(void *vstart, void *vend)
 {
   freerange(vstart, vend);
+  __sync_synchronize();
   kmem.use_lock = 1;
 }
 
@@ -51,6 +119,126 @@ freerange(void *vstart, void *vend)
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+
+// Add the free block r of the given order to its free list.
+static void
+buddypush(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.nblock[order]++;
+  pgorder[V2P(r)/PGSIZE] = order + 1;
+}
+
+// Remove the free block r of the given order from its free list.
+static void
+buddyunlink(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nblock[order]--;
+  pgorder[V2P(r)/PGSIZE] = 0;
+}
+
+// Allocate a block of 2^order pages, splitting a larger
+// block if necessary.  Caller must hold kmem.lock.
+static char*
+buddyalloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= KMAXORDER && kmem.freelist[k] == 0; k++)
+    ;
+  if(k > KMAXORDER)
+    return 0;
+  r = kmem.freelist[k];
+  buddyunlink(r, k);
+  // Give back the upper half at each level until r is the right size.
+  while(k > order){
+    k--;
+    buddypush((struct run*)((char*)r + (PGSIZE << k)), k);
+  }
+  kmem.nfree -= 1 << order;
+  return (char*)r;
+}
+
+// Free the block of 2^order pages at v, merging it with its
+// buddy as long as the buddy is free.  Caller must hold kmem.lock.
+static void
+buddyfree(char *v, int order)
+{
+  uint pa, bpa;
+
+  pa = V2P(v);
+  if(pgorder[pa/PGSIZE])
+    panic("kfree: double free");
+  kmem.nfree += 1 << order;
+  while(order < KMAXORDER){
+    bpa = pa ^ (PGSIZE << order);
+    if(bpa >= PHYSTOP || pgorder[bpa/PGSIZE] != order + 1)
+      break;
+    buddyunlink((struct run*)P2V(bpa), order);
+    pa &= ~(PGSIZE << order);
+    order++;
+  }
+  buddypush((struct run*)P2V(pa), order);
+}
+
+// Move KCACHEBATCH pages from the buddy allocator to c,
+// as one block if possible.  Caller must have interrupts disabled.
+static void
+krefill(struct kcache *c)
+{
+  struct run *r;
+  char *v;
+  int i;
+
+  acquire(&kmem.lock);
+  kmem.nlock++;
+  if((v = buddyalloc(KBATCHORDER)) != 0){
+    for(i = 0; i < KCACHEBATCH; i++, v += PGSIZE){
+      r = (struct run*)v;
+      r->next = c->freelist;
+      c->freelist = r;
+    }
+    c->n += KCACHEBATCH;
+  } else {
+    for(i = 0; i < KCACHEBATCH && (v = buddyalloc(0)) != 0; i++){
+      r = (struct run*)v;
+      r->next = c->freelist;
+      c->freelist = r;
+    }
+    c->n += i;
+  }
+  release(&kmem.lock);
+}
+
+// Move KCACHEBATCH pages from c back to the buddy allocator.
+// Caller must have interrupts disabled.
+static void
+kdrain(struct kcache *c)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  kmem.nlock++;
+  for(i = 0; i < KCACHEBATCH && (r = c->freelist) != 0; i++){
+    c->freelist = r->next;
+    buddyfree((char*)r, 0);
+  }
+  c->n -= i;
+  release(&kmem.lock);
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -60,37 +248,266 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *c;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  // A shared page is only freed by its last user.
+  if(pgref[V2P(v)/PGSIZE] > 1 &&
+     __sync_sub_and_fetch(&pgref[V2P(v)/PGSIZE], 1) > 0)
+    return;
+  pgref[V2P(v)/PGSIZE] = 0;
+
+#ifdef KALLOC_JUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){
+    buddyfree(v, 0);
+    return;
+  }
+
+  pushcli();
+  c = &kmem.cache[cpuid()];
+  r->next = c->freelist;
+  c->freelist = r;
+  c->n++;
+  c->nfree++;
+  if(c->n > KCACHEMAX)
+    kdrain(c);
+  popcli();
+}
+
+// Take a page from the pre-zeroed pool, or return 0 if it is empty.
+static struct run*
+zpoolget(void)
+{
+  struct run *r;
+
+  acquire(&zpool.lock);
+  r = zpool.freelist;
+  if(r){
+    zpool.freelist = r->next;
+    zpool.n--;
+  }
+  release(&zpool.lock);
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// The contents of the page are undefined.
 char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c;
 
+  if(!kmem.use_lock){
+    if((r = (struct run*)buddyalloc(0)) != 0)
+      pgref[V2P(r)/PGSIZE] = 1;
+    return (char*)r;
+  }
+
+  pushcli();
+  c = &kmem.cache[cpuid()];
+  if(c->freelist == 0)
+    krefill(c);
+  r = c->freelist;
+  if(r){
+    c->freelist = r->next;
+    c->n--;
+    c->nalloc++;
+  }
+  popcli();
+
+  // Out of ordinary pages; fall back on the zeroed pool.
+  if(r == 0 && (r = zpoolget()) != 0){
+    pushcli();
+    kmem.cache[cpuid()].nalloc++;
+    popcli();
+  }
+  if(r)
+    pgref[V2P(r)/PGSIZE] = 1;
+  return (char*)r;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size.  Returns 0 if the memory cannot be allocated.
+char*
+kallocpages(int order)
+{
+  char *v;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > KMAXORDER)
+    panic("kallocpages");
+  if(kmem.use_lock){
+    acquire(&kmem.lock);
+    kmem.nlock++;
+  }
+  if((v = buddyalloc(order)) != 0){
+    kmem.nalloc += 1 << order;
+    pgref[V2P(v)/PGSIZE] = 1;
+  }
   if(kmem.use_lock)
+    release(&kmem.lock);
+  return v;
+}
+
+// Free 2^order pages returned by kallocpages(order).
+void
+kfreepages(char *v, int order)
+{
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if(order < 0 || order > KMAXORDER ||
+     V2P(v) % (PGSIZE << order) || v < end || V2P(v) >= PHYSTOP)
+    panic("kfreepages");
+
+#ifdef KALLOC_JUNK
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  if(kmem.use_lock){
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+    kmem.nlock++;
+  }
+  kmem.nfreed += 1 << order;
+  pgref[V2P(v)/PGSIZE] = 0;
+  buddyfree(v, order);
   if(kmem.use_lock)
     release(&kmem.lock);
+}
+
+// Allocate one zero-filled page of physical memory.
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc_zeroed(void)
+{
+  struct run *r;
+  struct kcache *c;
+
+  if(kmem.use_lock && (r = zpoolget()) != 0){
+    // The run link is the only word of the page not zeroed.
+    r->next = 0;
+    pgref[V2P(r)/PGSIZE] = 1;
+    pushcli();
+    c = &kmem.cache[cpuid()];
+    c->nalloc++;
+    c->nzhit++;
+    popcli();
+    return (char*)r;
+  }
+  if((r = (struct run*)kalloc()) == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+  if(kmem.use_lock){
+    pushcli();
+    kmem.cache[cpuid()].nzmiss++;
+    popcli();
+  }
   return (char*)r;
 }
 
+// Called by the scheduler when it finds nothing to run.
+// Zeroes a few free pages and adds them to the zeroed pool.
+// The other CPUs start scheduling before kinit2(), while the
+// allocator is still unlocked, so wait until it is done.
+void
+kzeroidle(void)
+{
+  struct run *r;
+  char *v;
+  int i;
+
+  if(!kmem.use_lock)
+    return;
+  for(i = 0; i < ZIDLEBATCH; i++){
+    if(zpool.n >= ZPOOLMAX)
+      return;
+    if((v = kalloc()) == 0)
+      return;
+    memset(v, 0, PGSIZE);
+    r = (struct run*)v;
+    acquire(&zpool.lock);
+    r->next = zpool.freelist;
+    zpool.freelist = r;
+    zpool.n++;
+    release(&zpool.lock);
+    // Pages in the pool count as free, not allocated.
+    pushcli();
+    kmem.cache[cpuid()].nalloc--;
+    popcli();
+  }
+}
+
+// Add a reference to the page at v, which must have been
+// returned by kalloc().
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kref");
+  if(__sync_add_and_fetch(&pgref[V2P(v)/PGSIZE], 1) < 2)
+    panic("kref: free page");
+}
+
+// Drop a reference to the page at v without freeing it.
+// Returns the number of references left; at 0 the caller
+// holds the last one and must kfree() the page itself.
+int
+kunref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kunref");
+  if(pgref[V2P(v)/PGSIZE] > 1)
+    return __sync_sub_and_fetch(&pgref[V2P(v)/PGSIZE], 1);
+  return 0;
+}
+
+// Return the number of references to the page at v.
+int
+krefcount(char *v)
+{
+  return pgref[V2P(v)/PGSIZE];
+}
+
+// Fill in allocator statistics for getmemstat().
+// The per-CPU counters are read without stopping the other
+// CPUs, so the totals are only a snapshot.
+void
+kmemstat(struct memstat *ms)
+{
+  struct kcache *c;
+  int i;
+
+  memset(ms, 0, sizeof(*ms));
+  acquire(&kmem.lock);
+  ms->freepages = kmem.nfree;
+  ms->lockacq = kmem.nlock;
+  ms->allocs = kmem.nalloc;
+  ms->frees = kmem.nfreed;
+  for(i = 0; i <= KMAXORDER; i++)
+    ms->freeblocks[i] = kmem.nblock[i];
+  ms->freepages += zpool.n;
+  ms->zeropages = zpool.n;
+  for(c = kmem.cache; c < &kmem.cache[NCPU]; c++){
+    ms->freepages += c->n;
+    ms->cachedpages += c->n;
+    ms->allocs += c->nalloc;
+    ms->frees += c->nfree;
+    ms->zerohits += c->nzhit;
+    ms->zeromisses += c->nzmiss;
+  }
+  release(&kmem.lock);
+  ms->slabpages = slabpages();
+}
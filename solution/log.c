@@ -5,20 +5,37 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "fsstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
-// any reasoning required about whether a commit might
-// write an uncommitted system call's updates to disk.
+// calls. A transaction is only closed when there are no FS
+// system calls active in it. Thus there is never any reasoning
+// required about whether a commit might write an uncommitted
+// system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// But if it thinks the log is close to running out, or the
+// transaction is being closed, it sleeps until it can join
+// the next one.
+//
+// Transactions are committed in groups by the "commit" kernel
+// thread, not by end_op(): many system calls share one commit.
+// The thread closes the open transaction once it has waited
+// COMMITTICKS ticks, is close to filling the log, or fsync()
+// asks for it.  It copies the transaction's blocks into the log
+// area's buffers, lets new system calls start a fresh in-memory
+// transaction, and then writes the log, commits, and installs
+// in the background.  A block stays pinned in the cache with
+// B_DIRTY until its last logged update is installed, so install
+// writes it home straight from the cache; only if the next
+// transaction has changed it meanwhile does the copy go home
+// instead.  Commits never read the disk: the log area's buffers
+// are overwritten without being read, and only recovery after a
+// crash reads the log back.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -41,14 +58,30 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int closing;     // open transaction is being closed, please wait.
+  int syncreq;     // fsync() wants the open transaction committed.
+  uint opened;     // ticks when the open transaction logged its first block.
+  uint seq;        // sequence number of the open transaction.
+  uint durable;    // last transaction whose commit is on disk.
+  int ops;         // FS sys calls in the open transaction.
+  uint ncommit;    // commits since boot.
+  uint ncommitops; // FS sys calls in those commits.
+  uint nlogwrites; // log and header blocks written by commits.
+  uint ninstalls;  // blocks installed by commits.
+  uint ncopies;    // of those, installed from the log copy.
+  uint nreads;     // blocks commits had to read from disk.
   int dev;
-  struct logheader lh;
+  struct logheader lh;   // open transaction
+  struct logheader clh;  // transaction being committed
 };
 struct log log;
 
+// Disk block write for installing a logged copy, outside the
+// buffer cache, whose home block holds newer data.
+static struct buf installbuf;
+
 static void recover_from_log(void);
-static void commit();
+static void committer(void);
 
 void
 initlog(int dev)
@@ -58,14 +91,18 @@ initlog(int dev)
 
   struct superblock sb;
   initlock(&log.lock, "log");
+  initsleeplock(&installbuf.lock, "installbuf");
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
   log.dev = dev;
+  log.seq = 1;
   recover_from_log();
+  kthread("commit", committer);
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// Only recovery reads the log back from disk.
 static void
 install_trans(void)
 {
@@ -95,21 +132,23 @@ read_head(void)
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write log header lh to disk.
 // This is the true point at which the
-// current transaction commits.
+// transaction commits.
 static void
-write_head(void)
+write_head(struct logheader *lh)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bget(log.dev, log.start);  // no need to read it
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  memset(buf->data, 0, BSIZE);
+  hb->n = lh->n;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
   }
   bwrite(buf);
   brelse(buf);
+  log.nlogwrites++;
 }
 
 static void
@@ -118,7 +157,7 @@ recover_from_log(void)
   read_head();
   install_trans(); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  write_head(&log.lh); // clear the log
 }
 
 // called at the start of each FS system call.
@@ -127,7 +166,7 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
@@ -141,69 +180,180 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// The commit thread commits the transaction later.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
-  }
+  log.ops++;
+  // The commit thread may be waiting for the transaction to
+  // quiesce, and begin_op() may be waiting for log space,
+  // since decrementing log.outstanding has decreased the
+  // amount of reserved space.
+  wakeup(&log);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// bread() for the commit thread, counting disk reads.  The
+// blocks it asks for are pinned in the cache, so there should
+// be none.
+static struct buf*
+lread(uint blockno)
+{
+  struct buf *b = bget(log.dev, blockno);
+  if ((b->flags & B_VALID) == 0) {
+    iderw(b);
+    log.nreads++;
   }
+  return b;
 }
 
-// Copy modified blocks from cache to log.
+// Copy the blocks of the transaction being committed from the
+// cache into the log area's buffers, and return those, locked,
+// in lbuf.  No FS system call may be running.
 static void
-write_log(void)
+snapshot(struct buf **lbuf)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+  for (tail = 0; tail < log.clh.n; tail++) {
+    lbuf[tail] = bget(log.dev, log.start+tail+1); // log block, overwritten
+    struct buf *from = lread(log.clh.block[tail]); // cache block
+    memmove(lbuf[tail]->data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
   }
 }
 
+// Write the snapshot to the log, commit, and install it.
+static void
+commit(struct buf **lbuf)
+{
+  int tail, i;
+  struct buf *b;
+
+  for (tail = 0; tail < log.clh.n; tail++) {
+    bwrite(lbuf[tail]);  // write the log
+    log.nlogwrites++;
+  }
+  write_head(&log.clh);  // the real commit
+
+  acquire(&log.lock);
+  log.durable = log.seq - 1;
+  wakeup(&log);
+  release(&log.lock);
+
+  // Install to the home locations.  Holding b's lock keeps
+  // system calls from changing it, so if the open transaction
+  // has not logged it, the cached block is the committed one:
+  // write it from the cache, which also unpins it.  Otherwise
+  // write the log copy and leave it pinned.
+  for (tail = 0; tail < log.clh.n; tail++) {
+    b = lread(log.clh.block[tail]);
+    acquire(&log.lock);
+    for (i = 0; i < log.lh.n; i++)
+      if (log.lh.block[i] == b->blockno)
+        break;
+    release(&log.lock);
+    if (i == log.lh.n) {
+      bwrite(b);
+    } else {
+      acquiresleep(&installbuf.lock);
+      installbuf.dev = log.dev;
+      installbuf.blockno = b->blockno;
+      installbuf.flags = B_DIRTY;
+      memmove(installbuf.data, lbuf[tail]->data, BSIZE);
+      iderw(&installbuf);
+      releasesleep(&installbuf.lock);
+      log.ncopies++;
+    }
+    log.ninstalls++;
+    brelse(b);
+    brelse(lbuf[tail]);
+  }
+
+  log.clh.n = 0;
+  write_head(&log.clh);  // Erase the transaction from the log
+}
+
+// The commit thread.  Waits for a transaction worth committing,
+// closes it and commits it while the next one fills up.
 static void
-commit()
+committer(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
+  struct buf *lbuf[LOGSIZE];
+
+  acquire(&log.lock);
+  for(;;){
+    // Wait for a non-empty transaction that is full enough,
+    // old enough, or wanted by fsync().  While it is young,
+    // recheck on every clock tick.
+    while(log.lh.n == 0 ||
+          !(log.syncreq || log.lh.n + MAXOPBLOCKS > LOGSIZE ||
+            ticks - log.opened >= COMMITTICKS))
+      sleep(log.lh.n == 0 ? (void*)&log : (void*)&ticks, &log.lock);
+
+    // Close it: keep new FS system calls out until the
+    // ones in it have ended and its blocks are copied.
+    log.closing = 1;
+    while(log.outstanding > 0)
+      sleep(&log, &log.lock);
+    log.clh = log.lh;
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.syncreq = 0;
+    log.seq++;
+    log.ncommit++;
+    log.ncommitops += log.ops;
+    log.ops = 0;
+    release(&log.lock);
+
+    snapshot(lbuf);
+
+    acquire(&log.lock);
+    log.closing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    commit(lbuf);
+    acquire(&log.lock);
+  }
+}
+
+// Wait until every FS system call that has ended so far
+// is committed to disk.
+void
+log_sync(void)
+{
+  uint seq;
+
+  acquire(&log.lock);
+  seq = log.seq - 1;
+  if(log.lh.n > 0){
+    seq = log.seq;
+    log.syncreq = 1;
   }
+  while(log.durable < seq)
+    sleep(&log, &log.lock);
+  release(&log.lock);
+}
+
+// Fill in log statistics for getfsstat().
+void
+logstat(struct fsstat *fs)
+{
+  acquire(&log.lock);
+  fs->commits = log.ncommit;
+  fs->commitops = log.ncommitops;
+  fs->logwrites = log.nlogwrites;
+  fs->installs = log.ninstalls;
+  fs->installcopies = log.ncopies;
+  fs->commitreads = log.nreads;
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// The commit thread will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -226,9 +376,11 @@ log_write(struct buf *b)
       break;
   }
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n){
+    if (i == 0)
+      log.opened = ticks;
     log.lh.n++;
+  }
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
-
@@ -12,17 +12,21 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "fsstat.h"
 
-extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
+extern uchar _binary_fsmem_img_start[], _binary_fsmem_img_size[];
+
+int ideirq;                // no interrupts
 
 static int disksize;
 static uchar *memdisk;
+static uint memcmds;
 
 void
 ideinit(void)
 {
-  memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/BSIZE;
+  memdisk = _binary_fsmem_img_start;
+  disksize = (uint)_binary_fsmem_img_size/BSIZE;
 }
 
 // Interrupt handler.
@@ -35,6 +39,7 @@ ideintr(void)
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// A B_ASYNC buf is finished at once and handed to bdone().
 void
 iderw(struct buf *b)
 {
@@ -50,6 +55,7 @@ iderw(struct buf *b)
     panic("iderw: block out of range");
 
   p = memdisk + b->blockno*BSIZE;
+  memcmds++;
 
   if(b->flags & B_DIRTY){
     b->flags &= ~B_DIRTY;
@@ -57,4 +63,15 @@ iderw(struct buf *b)
   } else
     memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
+  if(b->flags & B_ASYNC)
+    bdone(b);
+}
+
+// Fill in disk statistics for getfsstat().
+void
+idestat(struct fsstat *fs)
+{
+  fs->diskdma = 0;
+  fs->diskcmds = memcmds;
+  fs->diskblocks = memcmds;
 }
@@ -0,0 +1,23 @@
+#ifndef __MEMSTAT_H
+#define __MEMSTAT_H
+
+#include "param.h"
+
+// Physical page allocator and page table statistics,
+// filled in by getmemstat().
+struct memstat {
+  uint allocs;        // pages handed out by kalloc() since boot
+  uint frees;         // pages returned by kfree() since boot
+  uint lockacq;       // acquisitions of the global allocator lock
+  uint freepages;     // free pages, including those in per-CPU caches
+  uint cachedpages;   // free pages sitting in per-CPU caches
+  uint zeropages;     // free pages already zeroed by idle CPUs
+  uint zerohits;      // kalloc_zeroed() calls served pre-zeroed
+  uint zeromisses;    // kalloc_zeroed() calls that zeroed synchronously
+  uint slabpages;     // pages held by slab caches for small objects
+  uint cr3loads;      // page table switches (TLB flushes)
+  uint cr3skips;      // page table switches skipped by the scheduler
+  uint freeblocks[KMAXORDER+1];  // free blocks of 2^i pages in the buddy allocator
+};
+
+#endif
@@ -0,0 +1,106 @@
+// Physical memory allocator stress benchmark.
+// Children repeatedly grow and shrink their heaps and fork
+// short-lived grandchildren (each needing a four-page kernel
+// stack), mixing single-page and multi-page allocations.
+// Reports the buddy allocator's free block histogram before
+// and after, to show fragmentation and that freed memory
+// coalesces again.
+//
+// usage: memstress [children [rounds]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "memstat.h"
+
+#define NCHILD 4
+#define NROUND 200
+
+static uint seed = 1;
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+void
+printstat(char *when, struct memstat *ms)
+{
+  int i, largest;
+
+  largest = -1;
+  printf(1, "memstress: %s: %d free pages (%d cached, %d pre-zeroed)\n",
+         when, ms->freepages, ms->cachedpages, ms->zeropages);
+  printf(1, "memstress: %s: free blocks by order:", when);
+  for(i = 0; i <= KMAXORDER; i++){
+    printf(1, " %d", ms->freeblocks[i]);
+    if(ms->freeblocks[i])
+      largest = i;
+  }
+  printf(1, "\n");
+  printf(1, "memstress: %s: largest free block is 2^%d pages\n", when, largest);
+}
+
+void
+child(int nround)
+{
+  int i, n, pid;
+  char *p;
+
+  for(i = 0; i < nround; i++){
+    n = (rand() % 64 + 1) * 4096;
+    if((p = sbrk(n)) == (char*)-1)
+      break;
+    p[0] = p[n-1] = i;
+    if(rand() % 4 == 0){
+      if((pid = fork()) == 0)
+        exit();
+      if(pid > 0)
+        wait();
+    }
+    sbrk(-(rand() % 2 ? n : n/2));
+  }
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat before, after;
+  int i, nchild, nround, start;
+
+  nchild = NCHILD;
+  nround = NROUND;
+  if(argc > 1)
+    nchild = atoi(argv[1]);
+  if(argc > 2)
+    nround = atoi(argv[2]);
+
+  if(getmemstat(&before) < 0){
+    printf(1, "memstress: getmemstat failed\n");
+    exit();
+  }
+  printstat("before", &before);
+  start = uptime();
+
+  for(i = 0; i < nchild; i++){
+    seed = i + 1;
+    if(fork() == 0)
+      child(nround);
+  }
+  for(i = 0; i < nchild; i++)
+    wait();
+
+  getmemstat(&after);
+  printf(1, "memstress: %d children x %d rounds in %d ticks\n",
+         nchild, nround, uptime() - start);
+  printf(1, "memstress: %d pages allocated, %d freed\n",
+         after.allocs - before.allocs, after.frees - before.frees);
+  printstat("after", &after);
+  if(after.freepages != before.freepages)
+    printf(1, "memstress: free pages changed by %d\n",
+           after.freepages - before.freepages);
+  exit();
+}
@@ -15,13 +15,15 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 12000
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
+int fssize = FSSIZE;
+int nbitmap;
+int ninodes = NINODES;
+int ninodeblocks;
 int nlog = LOGSIZE;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
@@ -31,6 +33,9 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+int hashdirs;           // build the root directory hashed
+struct dirent ents[NINODES];  // root entries, when hashed
+int nents;
 
 
 void balloc(int);
@@ -40,6 +45,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dxbuild(uint inum);
 
 // convert to intel byte order
 ushort
@@ -76,10 +82,31 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  // -s blocks and -i inodes make a smaller image, for kernelmemfs.
+  // -h makes the root directory hashed.
+  for(;;){
+    if(argc > 2 && strcmp(argv[1], "-s") == 0){
+      fssize = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if(argc > 2 && strcmp(argv[1], "-i") == 0){
+      ninodes = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if(argc > 1 && strcmp(argv[1], "-h") == 0){
+      hashdirs = 1;
+      argc--;
+      argv++;
+    } else
+      break;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-s blocks] [-i inodes] [-h] fs.img files...\n");
     exit(1);
   }
+  assert(ninodes <= NINODES);
+  nbitmap = fssize/(BSIZE*8) + 1;
+  ninodeblocks = ninodes / IPB + 1;
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
@@ -92,22 +119,22 @@ main(int argc, char *argv[])
 
   // 1 fs block = 1 disk sector
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  nblocks = fssize - nmeta;
 
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
+  for(i = 0; i < fssize; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
@@ -147,7 +174,10 @@ main(int argc, char *argv[])
     bzero(&de, sizeof(de));
     de.inum = xshort(inum);
     strncpy(de.name, argv[i], DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    if(hashdirs)
+      ents[nents++] = de;
+    else
+      iappend(rootino, &de, sizeof(de));
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -155,12 +185,16 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  if(hashdirs){
+    dxbuild(rootino);
+  } else {
+    // fix size of root inode dir
+    rinode(rootino, &din);
+    off = xint(din.size);
+    off = ((off/BSIZE) + 1) * BSIZE;
+    din.size = xint(off);
+    winode(rootino, &din);
+  }
 
   balloc(freeblock);
 
@@ -238,16 +272,18 @@ void
 balloc(int used)
 {
   uchar buf[BSIZE];
-  int i;
+  int i, b;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  assert(used < nbitmap*BPB);
+  for(b = 0; b*BPB < used; b++){
+    bzero(buf, BSIZE);
+    for(i = 0; i < BPB && b*BPB + i < used; i++){
+      buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    }
+    printf("balloc: write bitmap block at sector %d\n", sb.bmapstart + b);
+    wsect(sb.bmapstart + b, buf);
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -256,7 +292,7 @@ void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
-  uint fbn, off, n1;
+  uint fbn, bn, off, n1;
   struct dinode din;
   char buf[BSIZE];
   uint indirect[NINDIRECT];
@@ -273,7 +309,7 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
@@ -283,6 +319,24 @@ iappend(uint inum, void *xp, int n)
         wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
       }
       x = xint(indirect[fbn-NDIRECT]);
+    } else {
+      // double-indirect block, then an indirect block
+      bn = fbn - NDIRECT - NINDIRECT;
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
+      }
+      rsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      if(indirect[bn / NINDIRECT] == 0){
+        indirect[bn / NINDIRECT] = xint(freeblock++);
+        wsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      }
+      x = xint(indirect[bn / NINDIRECT]);
+      rsect(x, (char*)indirect);
+      if(indirect[bn % NINDIRECT] == 0){
+        indirect[bn % NINDIRECT] = xint(freeblock++);
+        wsect(x, (char*)indirect);
+      }
+      x = xint(indirect[bn % NINDIRECT]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -295,3 +349,84 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Hash of a directory entry name, as in fs.c.
+uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+int
+dxcmp(const void *a, const void *b)
+{
+  uint ha = dxhash(((struct dirent*)a)->name);
+  uint hb = dxhash(((struct dirent*)b)->name);
+
+  return ha < hb ? -1 : ha > hb;
+}
+
+void
+dxset(struct dxslot *s, int i, uint hash, uint blk)
+{
+  s[i/2].hash[i%2] = xint(hash);
+  s[i/2].blk[i%2] = xshort(blk);
+}
+
+// Lay out the entries in ents, after the "." and ".." that
+// directory inum already has, as a hashed directory (see fs.h):
+// the rest of block 0, then the index blocks, then leaves filled
+// three quarters full, leaving room for new entries.
+void
+dxbuild(uint inum)
+{
+  static struct dirent leaf[NINODES][DXSLOTS];
+  static uint first[NINODES];
+  struct dxslot blk0[DXSLOTS-2], idx[DXSLOTS];
+  struct dxhead *hd;
+  int i, n, l, r, nleaf, nidx;
+
+  qsort(ents, nents, sizeof(ents[0]), dxcmp);
+
+  // Fill leaves, keeping names with the same hash together.
+  bzero(leaf, sizeof(leaf));
+  nleaf = 1;
+  first[0] = 0;
+  n = 0;
+  for(i = 0; i < nents; i++){
+    if(n >= DXSLOTS*3/4 &&
+       dxhash(ents[i].name) != dxhash(ents[i-1].name)){
+      first[nleaf++] = dxhash(ents[i].name);
+      n = 0;
+    }
+    assert(n < DXSLOTS);
+    leaf[nleaf-1][n++] = ents[i];
+  }
+  nidx = (nleaf + DXINDEX - 1) / DXINDEX;
+  assert(nidx <= DXROOT);
+
+  bzero(blk0, sizeof(blk0));
+  hd = (struct dxhead*)blk0;
+  hd->magic = xshort(DXMAGIC);
+  for(r = 0; r < nidx; r++)
+    dxset(blk0 + 1, r, first[r*DXINDEX], 1 + r);
+  iappend(inum, blk0, sizeof(blk0));
+
+  for(r = 0; r < nidx; r++){
+    bzero(idx, sizeof(idx));
+    for(l = r*DXINDEX; l < nleaf && l < (r+1)*DXINDEX; l++)
+      dxset(idx, l - r*DXINDEX, first[l], 1 + nidx + l);
+    iappend(inum, idx, sizeof(idx));
+  }
+
+  for(l = 0; l < nleaf; l++)
+    iappend(inum, leaf[l], sizeof(leaf[l]));
+}
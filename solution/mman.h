@@ -0,0 +1,11 @@
+// mmap() protection bits.
+#define PROT_NONE     0x0
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+
+// mmap() flags.  One of MAP_SHARED and MAP_PRIVATE must be given.
+#define MAP_SHARED    0x01  // share changes, writing them back to the file
+#define MAP_PRIVATE   0x02  // changes are private to the process
+#define MAP_ANONYMOUS 0x20  // zero-filled memory; fd and off are ignored
+
+#define MAP_FAILED    ((void*)-1)
@@ -0,0 +1,400 @@
+// Memory mappings made with mmap().
+//
+// Each process has a list of struct vma, sorted by address,
+// describing its mappings.  Mappings are placed top-down below
+// KERNBASE, and the heap may grow up to the lowest one.  Pages
+// are mapped on first touch by mmapfault(), called from
+// pagefault().
+//
+// Shared memory segments (see shm.c) are attached as shared
+// mappings whose pages come from the segment.
+//
+// A private file mapping gets its own copy of the file's data,
+// which fork() shares copy-on-write.  The pages of a shared
+// mapping are mapped as they are in the child; fork() first
+// faults in any missing ones so that parent and child end up
+// with the same pages.  Dirty pages of a shared file mapping are
+// written back to the file when they are unmapped.  Shared file
+// mappings made separately, and write(), are not kept coherent
+// with each other.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "memlayout.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "slab.h"
+#include "mman.h"
+
+static struct kmem_cache vmacache;
+
+void
+mmapinit(void)
+{
+  kmem_cache_init(&vmacache, "vmacache", sizeof(struct vma), 0);
+}
+
+// Return p's mapping that contains va, or 0 if there is none.
+struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vmas; v; v = v->next)
+    if(va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Return 1 if [va, va+len) lies within one of p's mappings.
+int
+inmmap(struct proc *p, uint va, uint len)
+{
+  struct vma *v;
+
+  if((v = findvma(p, va)) == 0)
+    return 0;
+  return va + len >= va && va + len <= v->end;
+}
+
+// Return the lowest address of p's mappings.
+// The heap must stay below it.
+uint
+mmapbase(struct proc *p)
+{
+  if(p->vmas)
+    return p->vmas->start;
+  return KERNBASE;
+}
+
+// Return the start of the highest free range of len bytes
+// between the top of p's heap and KERNBASE, or 0 if there
+// is none.
+static uint
+vmaplace(struct proc *p, uint len)
+{
+  struct vma *v;
+  uint lo, hi, best;
+
+  best = 0;
+  lo = PGROUNDUP(p->sz);
+  for(v = p->vmas;; v = v->next){
+    hi = v ? v->start : KERNBASE;
+    if(hi >= lo && hi - lo >= len)
+      best = hi - len;
+    if(v == 0)
+      break;
+    lo = v->end;
+  }
+  return best;
+}
+
+// Make a new mapping of len bytes, a multiple of PGSIZE, in the
+// current process.  The caller fills in what it maps.
+static struct vma*
+vmacreate(uint len)
+{
+  struct proc *p = myproc();
+  struct vma *v, **pp;
+  uint va;
+
+  if((va = vmaplace(p, len)) == 0)
+    return 0;
+  if((v = kmem_cache_alloc(&vmacache)) == 0)
+    return 0;
+  v->start = va;
+  v->end = va + len;
+  v->f = 0;
+  v->off = 0;
+  v->shm = 0;
+  for(pp = &p->vmas; *pp && (*pp)->start < va; pp = &(*pp)->next)
+    ;
+  v->next = *pp;
+  *pp = v;
+  return v;
+}
+
+// Map len bytes of f starting at offset off into the current
+// process, or zero-filled memory if flags has MAP_ANONYMOUS.
+// Returns the address of the mapping, or -1.
+int
+mmap(uint len, int prot, int flags, struct file *f, uint off)
+{
+  struct vma *v;
+
+  if(len == 0 || len > KERNBASE || off % PGSIZE != 0)
+    return -1;
+  switch(flags & (MAP_SHARED|MAP_PRIVATE)){
+  case MAP_SHARED:
+  case MAP_PRIVATE:
+    break;
+  default:
+    return -1;
+  }
+  if(flags & MAP_ANONYMOUS)
+    f = 0;
+  else {
+    if(f == 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  if((v = vmacreate(PGROUNDUP(len))) == 0)
+    return -1;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = f ? filedup(f) : 0;
+  v->off = off;
+  return v->start;
+}
+
+// Map shared memory segment s, of len bytes, into the current
+// process.  Takes over the caller's reference to s on success.
+// Returns the address of the mapping, or -1.
+int
+mmapshm(struct shmseg *s, uint len)
+{
+  struct vma *v;
+
+  if((v = vmacreate(len)) == 0)
+    return -1;
+  v->prot = PROT_READ|PROT_WRITE;
+  v->flags = MAP_SHARED;
+  v->shm = s;
+  return v->start;
+}
+
+// Map the page at va of mapping v for p, which touched it
+// for the first time.  err is the page fault error code.
+// Returns 0 on success, -1 if the access is not allowed or
+// memory ran out.
+int
+mmapfault(struct proc *p, struct vma *v, uint va, uint err)
+{
+  char *mem;
+  int n, perm;
+
+  if(v->prot == PROT_NONE)
+    return -1;
+  if((err & FEC_WR) && (v->prot & PROT_WRITE) == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+  perm = PTE_U;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->shm){
+    mem = shmpage(v->shm, v->off + (va - v->start));
+    if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0)
+      return -1;
+    kref(mem);
+    p->rss++;
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  n = 0;
+  if(v->f){
+    ilock(v->f->ip);
+    n = readi(v->f->ip, mem, v->off + (va - v->start), PGSIZE);
+    iunlock(v->f->ip);
+    if(n < 0)
+      n = 0;
+  }
+  memset(mem + n, 0, PGSIZE - n);
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  p->rss++;
+  return 0;
+}
+
+// Write the dirty pages of shared file mapping v in [start, end)
+// back to the file.  Only the part of the file that exists is
+// written; a mapping never makes a file longer.
+static void
+writeback(struct proc *p, struct vma *v, uint start, uint end)
+{
+  struct inode *ip;
+  pte_t *pte;
+  char *src;
+  uint a, off;
+  int i, n;
+
+  // Same transaction size limit as filewrite().
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+
+  ip = v->f->ip;
+  for(a = start; a < end; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+      continue;
+    src = P2V(PTE_ADDR(*pte));
+    off = v->off + (a - v->start);
+    for(i = 0; i < PGSIZE; i += n){
+      begin_op();
+      ilock(ip);
+      n = 0;
+      if(off + i < ip->size){
+        n = PGSIZE - i;
+        if(n > max)
+          n = max;
+        if(off + i + n > ip->size)
+          n = ip->size - off - i;
+        if(writei(ip, src + i, off + i, n) != n)
+          n = 0;
+      }
+      iunlock(ip);
+      end_op();
+      if(n == 0)
+        break;
+    }
+  }
+}
+
+// Remove p's pages of mapping v in [start, end).
+static void
+vmaunmap(struct proc *p, struct vma *v, uint start, uint end)
+{
+  if(v->f && (v->flags & MAP_SHARED))
+    writeback(p, v, start, end);
+  p->rss -= residentuvm(p->pgdir, start, end);
+  deallocuvm(p->pgdir, end, start);
+}
+
+static void
+vmafree(struct vma *v)
+{
+  if(v->f)
+    fileclose(v->f);
+  if(v->shm)
+    shmput(v->shm);
+  kmem_cache_free(&vmacache, v);
+}
+
+// Remove the current process's mappings in [va, va+len).
+// Returns 0 on success, -1 on error.
+int
+munmap(uint va, uint len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv, **pp;
+  uint start, end;
+
+  if(va % PGSIZE != 0 || len == 0 || va >= KERNBASE || len > KERNBASE - va)
+    return -1;
+  end = PGROUNDUP(va + len);
+
+  // Unmapping the middle of a mapping splits it in two.
+  // Allocate the second half now, so nothing fails later.
+  nv = 0;
+  for(v = p->vmas; v; v = v->next){
+    if(va > v->start && end < v->end){
+      if((nv = kmem_cache_alloc(&vmacache)) == 0)
+        return -1;
+      break;
+    }
+  }
+
+  pp = &p->vmas;
+  while((v = *pp) != 0){
+    if(v->end <= va || v->start >= end){
+      pp = &v->next;
+      continue;
+    }
+    start = va > v->start ? va : v->start;
+    vmaunmap(p, v, start, end < v->end ? end : v->end);
+    if(start == v->start && end >= v->end){
+      *pp = v->next;
+      vmafree(v);
+      continue;
+    }
+    if(start == v->start){
+      v->off += end - v->start;
+      v->start = end;
+    } else if(end >= v->end){
+      v->end = start;
+    } else {
+      *nv = *v;
+      nv->start = end;
+      nv->off = v->off + (end - v->start);
+      if(nv->f)
+        filedup(nv->f);
+      if(nv->shm)
+        shmdup(nv->shm);
+      v->end = start;
+      v->next = nv;
+      v = nv;
+    }
+    pp = &v->next;
+  }
+  lcr3(V2P(p->pgdir));  // flush TLB entries of removed pages
+  return 0;
+}
+
+// Remove all of p's mappings, for exit() and exec().
+void
+munmapall(struct proc *p)
+{
+  struct vma *v;
+
+  while((v = p->vmas) != 0){
+    p->vmas = v->next;
+    vmaunmap(p, v, v->start, v->end);
+    vmafree(v);
+  }
+}
+
+// Give np, a child being created by fork(), copies of p's
+// mappings and their pages.  Returns 0 on success, -1 on error.
+int
+mmapcopy(struct proc *np, struct proc *p)
+{
+  struct vma *v, *nv, **pp;
+  pte_t *pte;
+  uint a;
+
+  np->vmas = 0;
+  pp = &np->vmas;
+  for(v = p->vmas; v; v = v->next){
+    if((v->flags & MAP_SHARED) && v->prot != PROT_NONE){
+      for(a = v->start; a < v->end; a += PGSIZE){
+        pte = walkpgdir(p->pgdir, (char*)a, 0);
+        if((pte == 0 || (*pte & PTE_P) == 0) && mmapfault(p, v, a, 0) < 0)
+          goto bad;
+      }
+    }
+    if((nv = kmem_cache_alloc(&vmacache)) == 0)
+      goto bad;
+    *nv = *v;
+    nv->next = 0;
+    if(nv->f)
+      filedup(nv->f);
+    if(nv->shm)
+      shmdup(nv->shm);
+    *pp = nv;
+    pp = &nv->next;
+    if(sharepages(np->pgdir, p->pgdir, v->start, v->end,
+                  (v->flags & MAP_SHARED) == 0) < 0)
+      goto bad;
+  }
+  // Private pages of p just lost PTE_W; flush its stale TLB entries.
+  lcr3(V2P(p->pgdir));
+  return 0;
+
+bad:
+  lcr3(V2P(p->pgdir));
+  while((nv = np->vmas) != 0){
+    np->vmas = nv->next;
+    vmafree(nv);
+  }
+  return -1;
+}
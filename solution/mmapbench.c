@@ -0,0 +1,130 @@
+// mmap benchmark.
+// Writes a test file, then scans it repeatedly with read() and
+// through a private mmap() of the file, and checks that both
+// see the same data.  Also checks that a shared anonymous
+// mapping is shared with a child and that a shared file
+// mapping is written back to the file.
+//
+// usage: mmapbench [kbytes [passes]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "mman.h"
+
+#define NKB     32
+#define NPASS   20
+
+char *file = "mmapbench.dat";
+char buf[1024];
+
+uint
+scan(char *p, int n)
+{
+  uint sum;
+  int i;
+
+  sum = 0;
+  for(i = 0; i < n; i++)
+    sum = sum * 31 + p[i];
+  return sum;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, j, n, size, npass, start, tread, tmap;
+  uint rsum, msum;
+  char *p;
+  int *shared;
+
+  n = NKB;
+  npass = NPASS;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(argc > 2)
+    npass = atoi(argv[2]);
+  size = n * 1024;
+
+  if((fd = open(file, O_CREATE|O_RDWR)) < 0){
+    printf(1, "mmapbench: cannot create %s\n", file);
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    for(j = 0; j < sizeof(buf); j++)
+      buf[j] = 'a' + (i + j) % 26;
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "mmapbench: write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  // Scan with read().
+  rsum = 0;
+  start = uptime();
+  for(i = 0; i < npass; i++){
+    fd = open(file, O_RDONLY);
+    while((j = read(fd, buf, sizeof(buf))) > 0)
+      rsum += scan(buf, j);
+    close(fd);
+  }
+  tread = uptime() - start;
+
+  // Scan through a private mapping.
+  msum = 0;
+  start = uptime();
+  for(i = 0; i < npass; i++){
+    fd = open(file, O_RDONLY);
+    p = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED){
+      printf(1, "mmapbench: mmap failed\n");
+      exit();
+    }
+    for(j = 0; j < size; j += sizeof(buf))
+      msum += scan(p + j, sizeof(buf));
+    munmap(p, size);
+  }
+  tmap = uptime() - start;
+
+  printf(1, "mmapbench: %d passes over %d KB: read %d ticks, mmap %d ticks\n",
+         npass, n, tread, tmap);
+  if(rsum != msum)
+    printf(1, "mmapbench: read and mmap saw different data\n");
+
+  // A shared anonymous mapping is shared with children.
+  shared = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(shared == MAP_FAILED){
+    printf(1, "mmapbench: anonymous mmap failed\n");
+    exit();
+  }
+  shared[0] = 1;
+  if(fork() == 0){
+    shared[0] = 2;
+    exit();
+  }
+  wait();
+  printf(1, "mmapbench: shared anonymous mapping %s\n",
+         shared[0] == 2 ? "ok" : "not shared");
+  munmap(shared, 4096);
+
+  // A shared file mapping is written back.
+  fd = open(file, O_RDWR);
+  p = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED){
+    printf(1, "mmapbench: shared mmap failed\n");
+    exit();
+  }
+  p[0] = 'X';
+  p[size-1] = 'Y';
+  munmap(p, size);
+  read(fd, buf, 1);
+  close(fd);
+  printf(1, "mmapbench: shared file mapping %s\n",
+         buf[0] == 'X' ? "written back" : "not written back");
+
+  unlink(file);
+  exit();
+}
@@ -1,16 +1,29 @@
 #define NPROC        64  // maximum number of processes
-#define KSTACKSIZE 4096  // size of per-process kernel stack
+#define KSTACKSIZE 16384 // size of per-process kernel stack
+#define KSTACKORDER   2  // KSTACKSIZE is 2^KSTACKORDER pages
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
+#define MAXSEG        4  // max demand-paged program segments
+#define EXECAHEAD     4  // program pages read per page fault
+#define NSHM         16  // maximum shared memory segments
+#define SHMMAXPG     64  // maximum pages per shared memory segment
+#define MAXOPBLOCKS  14  // max # of blocks any FS op writes (see dxlink)
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000 // size of file system in blocks
+#define COMMITTICKS  10   // most ticks a transaction waits to be committed
+#define NBUF         (LOGSIZE*4)  // minimum size of disk block cache
+#define NBUFMAX      4096 // maximum size of disk block cache
+#define BCACHEDIV    16   // disk block cache gets 1/BCACHEDIV of free memory
+#define READAHEAD    32   // most blocks read ahead of a sequential reader
+#define FSSIZE       24000 // size of file system in blocks
+#define BRESERVE     16   // blocks reserved past a file's last allocation
+#define NDENTRY      512  // entries in the directory name cache
+#define NINODE       50   // minimum size of inode cache
+#define NINODEMAX    4096 // maximum size of inode cache
+#define ICACHEDIV    64   // inode cache gets 1/ICACHEDIV of free memory
+#define KMAXORDER    10   // largest physical allocation is 2^KMAXORDER pages
 #define STRIDE1      1024 // stride for 1 ticket
 #define TICKETS_INIT 8    // default tickets for a process
 #define TICKETS_MAX  32   // max tickets for a process
\ No newline at end of file
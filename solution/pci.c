@@ -0,0 +1,106 @@
+// PCI configuration space access, using the legacy
+// configuration mechanism #1 (I/O ports 0xCF8 and 0xCFC).
+// Just enough for drivers to find their device, see where
+// its registers are and turn on bus mastering.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_CONFADDR 0xcf8
+#define PCI_CONFDATA 0xcfc
+
+// Configuration space registers.
+#define PCI_ID       0x00  // vendor (low), device (high)
+#define PCI_COMMAND  0x04
+#define PCI_CLASS    0x08  // class in bits 31:24, subclass 23:16
+#define PCI_HEADER   0x0c  // header type in bits 23:16
+#define PCI_BAR0     0x10
+#define PCI_INTR     0x3c  // interrupt line in bits 7:0
+
+#define PCI_CMD_IO     0x1
+#define PCI_CMD_MEM    0x2
+#define PCI_CMD_MASTER 0x4
+
+static uint
+pciaddr(int bus, int dev, int fn, int off)
+{
+  return 0x80000000 | (bus << 16) | (dev << 11) | (fn << 8) | (off & 0xfc);
+}
+
+uint
+pciread(struct pcidev *d, int off)
+{
+  outl(PCI_CONFADDR, pciaddr(d->bus, d->dev, d->fn, off));
+  return inl(PCI_CONFDATA);
+}
+
+void
+pciwrite(struct pcidev *d, int off, uint v)
+{
+  outl(PCI_CONFADDR, pciaddr(d->bus, d->dev, d->fn, off));
+  outl(PCI_CONFDATA, v);
+}
+
+// Fill in *d for the function at bus/dev/fn.
+// Returns -1 if there is no such function.
+static int
+pciprobe(int bus, int dev, int fn, struct pcidev *d)
+{
+  uint id, class;
+  int i;
+
+  d->bus = bus;
+  d->dev = dev;
+  d->fn = fn;
+  id = pciread(d, PCI_ID);
+  if((id & 0xffff) == 0xffff)
+    return -1;
+  class = pciread(d, PCI_CLASS);
+  d->vendor = id & 0xffff;
+  d->device = id >> 16;
+  d->class = class >> 24;
+  d->subclass = class >> 16;
+  d->irq = pciread(d, PCI_INTR);
+  for(i = 0; i < 6; i++)
+    d->bar[i] = pciread(d, PCI_BAR0 + 4*i);
+  return 0;
+}
+
+// Find the first PCI function that matches vendor and device,
+// or, if vendor is 0, class and subclass.  Fills in *d and
+// returns 0, or returns -1 if there is none.
+int
+pcifind(ushort vendor, ushort device, uchar class, uchar subclass,
+        struct pcidev *d)
+{
+  int bus, dev, fn, nfn;
+
+  for(bus = 0; bus < 256; bus++){
+    for(dev = 0; dev < 32; dev++){
+      nfn = 1;
+      for(fn = 0; fn < nfn; fn++){
+        if(pciprobe(bus, dev, fn, d) < 0)
+          continue;
+        if(fn == 0 && (pciread(d, PCI_HEADER) & 0x800000))
+          nfn = 8;  // multi-function device
+        if(vendor ? d->vendor == vendor && d->device == device
+                  : d->class == class && d->subclass == subclass)
+          return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+// Let d respond to I/O and memory accesses and
+// master the bus for DMA.
+void
+pcienable(struct pcidev *d)
+{
+  uint cmd;
+
+  cmd = pciread(d, PCI_COMMAND) & 0xffff;
+  pciwrite(d, PCI_COMMAND, cmd | PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER);
+}
@@ -0,0 +1,16 @@
+// PCI devices, as found by pcifind().  See pci.c.
+
+#define PCI_CLASS_STORAGE  0x01
+#define PCI_SUBCLASS_IDE   0x01
+
+struct pcidev {
+  int bus;
+  int dev;
+  int fn;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar irq;        // interrupt line, as set up by the BIOS
+  uint bar[6];      // base address registers
+};
@@ -6,6 +6,8 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "spawn.h"
+#include "pstat.h"
 
 #ifdef STRIDE
 int stride_scheduler = 1;
@@ -94,11 +96,17 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->lastcpu = 0;
+  p->nfault = 0;
+  p->nfork = 0;
+  p->nexec = 0;
+  p->nsyscall = 0;
+  p->kfn = 0;
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
-  if((p->kstack = kalloc()) == 0){
+  if((p->kstack = kallocpages(KSTACKORDER)) == 0){
     p->state = UNUSED;
     return 0;
   }
@@ -136,6 +144,10 @@ userinit(void)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
   p->sz = PGSIZE;
+  p->rss = 1;
+  p->exe = 0;
+  p->nseg = 0;
+  p->vmas = 0;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -179,9 +191,13 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Only reserve the address space; pagefault() maps
+    // zeroed pages as they are first touched.
+    if(sz + n > mmapbase(curproc) || sz + n < sz)
       return -1;
+    sz += n;
   } else if(n < 0){
+    curproc->rss -= residentuvm(curproc->pgdir, sz + n, sz);
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   }
@@ -190,6 +206,20 @@ growproc(int n)
   return 0;
 }
 
+// Give np the initial stride scheduling state.
+// Caller must hold ptable.lock.
+static void
+strideinit(struct proc *np)
+{
+  np->tickets = TICKETS_INIT;
+  np->stride = STRIDE1/np->tickets;
+  np->pass = 0;
+  np->remain = np->stride;
+  np->last_scheduled = 0;
+  np->last_interrupted = 0;
+  np->runtime = 0;
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -207,12 +237,21 @@ fork(void)
 
   // Copy process state from proc.
   if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
-    kfree(np->kstack);
+    kfreepages(np->kstack, KSTACKORDER);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  if(mmapcopy(np, curproc) < 0){
+    freevm(np->pgdir);
+    np->pgdir = 0;
+    kfreepages(np->kstack, KSTACKORDER);
     np->kstack = 0;
     np->state = UNUSED;
     return -1;
   }
   np->sz = curproc->sz;
+  np->rss = curproc->rss;
   np->parent = curproc;
   *np->tf = *curproc->tf;
 
@@ -223,10 +262,15 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  if(curproc->exe)
+    np->exe = idup(curproc->exe);
+  np->nseg = curproc->nseg;
+  memmove(np->seg, curproc->seg, sizeof(np->seg));
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
   pid = np->pid;
+  curproc->nfork++;
 
 
   acquire(&ptable.lock);
@@ -235,20 +279,113 @@ fork(void)
 
   if (stride_scheduler) {
     cprintf("adding stride details for PID: %d in fork()\n", pid);
-    np->tickets = TICKETS_INIT;
-    np->stride = STRIDE1/np->tickets;
-    np->pass = 0;
-    np->remain = np->stride;
-    np->last_scheduled = 0;
-    np->last_interrupted = 0;
-    np->runtime = 0;
+    strideinit(np);
+  }
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
+// Create a new child process running the program at path,
+// without copying the current process's memory.  The child
+// inherits the parent's open files, changed as described by
+// the nact entries of act.
+int
+spawn(char *path, char **argv, struct spawnfd *act, int nact)
+{
+  int i, fd, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  for(i = 0; i < nact; i++){
+    if(act[i].fd < 0 || act[i].fd >= NOFILE)
+      return -1;
+    if(act[i].from != -1 &&
+       (act[i].from < 0 || act[i].from >= NOFILE || curproc->ofile[act[i].from] == 0))
+      return -1;
   }
 
+  if((np = allocproc()) == 0)
+    return -1;
+
+  // The child starts in user mode at the program's entry point
+  // with the same segments and flags as the parent.
+  *np->tf = *curproc->tf;
+  np->tf->eax = 0;
+  np->pgdir = 0;
+  np->exe = 0;
+  np->vmas = 0;
+  if(execproc(np, path, argv) < 0){
+    kfreepages(np->kstack, KSTACKORDER);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->parent = curproc;
+
+  for(i = 0; i < NOFILE; i++)
+    if(curproc->ofile[i])
+      np->ofile[i] = filedup(curproc->ofile[i]);
+  for(i = 0; i < nact; i++){
+    fd = act[i].fd;
+    if(np->ofile[fd])
+      fileclose(np->ofile[fd]);
+    np->ofile[fd] = 0;
+    if(act[i].from != -1)
+      np->ofile[fd] = filedup(curproc->ofile[act[i].from]);
+  }
+  np->cwd = idup(curproc->cwd);
+
+  pid = np->pid;
+  curproc->nfork++;
+
+  acquire(&ptable.lock);
+  np->state = RUNNABLE;
+  if(stride_scheduler)
+    strideinit(np);
   release(&ptable.lock);
 
   return pid;
 }
 
+// First code run by a kernel thread, in place of forkret().
+static void
+kthreadstart(void)
+{
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+  myproc()->kfn();
+  panic("kthread returned");
+}
+
+// Start a kernel thread that runs fn(), which must not return.
+// A kernel thread has no user memory and never leaves the kernel.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread: no process");
+  if((p->pgdir = setupkvm()) == 0)
+    panic("kthread: out of memory");
+  p->sz = 0;
+  p->rss = 0;
+  p->exe = 0;
+  p->nseg = 0;
+  p->vmas = 0;
+  p->kfn = fn;
+  p->context->eip = (uint)kthreadstart;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  if(stride_scheduler)
+    strideinit(p);
+  release(&ptable.lock);
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -262,6 +399,9 @@ exit(void)
   if(curproc == initproc)
     panic("init exiting");
 
+  munmapall(curproc);
+  shmexit(curproc);
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -272,8 +412,11 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->exe)
+    iput(curproc->exe);
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
 
   acquire(&ptable.lock);
 
@@ -315,7 +458,7 @@ wait(void)
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
-        kfree(p->kstack);
+        kfreepages(p->kstack, KSTACKORDER);
         p->kstack = 0;
         freevm(p->pgdir);
         p->pid = 0;
@@ -361,6 +504,7 @@ sched_RR(void)
   cprintf("running RR scheduler\n");
   struct proc *p;
   struct cpu *c = mycpu();
+  int ran;
   c->proc = 0;
 
   for(;;) {
@@ -368,6 +512,7 @@ sched_RR(void)
     sti();
 
     // Loop over process table looking for process to run.
+    ran = 0;
     acquire(&ptable.lock);
     // cprintf("acquired ptable lock\n");
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
@@ -378,19 +523,26 @@ sched_RR(void)
       // to release ptable.lock and then reacquire it
       // before jumping back to us.
       c->proc = p;
-      switchuvm(p);
+      lazyswitchuvm(p);
       p->state = RUNNING;
+      ran = 1;
       
       cprintf("switching to PID: %d\n",p->pid);
       swtch(&(c->scheduler), p->context);
       cprintf("got back from PID: %d\n",p->pid);
-      switchkvm();
+      // Stay on p's page table unless p is about to be freed.
+      if(p->state == ZOMBIE)
+        switchkvm();
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
       c->proc = 0;
     }
     release(&ptable.lock);
+
+    // Nothing to run; use the idle time to pre-zero free pages.
+    if(!ran)
+      kzeroidle();
   }
 }
 
@@ -463,8 +615,8 @@ sched_stride(void)
     sti();
 
     // Loop over process table looking for process to run.
-    // acquire(&ptable.lock);
-    // cprintf("acquired lock\n");
+    acquire(&ptable.lock);
+    cprintf("acquired lock\n");
 
     minheap heap;
     heap.size = 0;
@@ -479,44 +631,44 @@ sched_stride(void)
     }
 
     if (heap.size > 0) {
+      // The heap holds copies; run the ptable entry itself, so
+      // that its state and lazyswitchuvm()'s bookkeeping stick.
       struct proc* minproc = getmin(&heap);
-      p = minproc;
-      // p = &ptable.proc[0];
+      for(p = ptable.proc; p->pid != minproc->pid; p++)
+        ;
       cprintf("chosen process PID: %d\n", p->pid);
       
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
       // before jumping back to us.
       c->proc = p;
-      switchuvm(p);
-
-      acquire(&ptable.lock);
-      cprintf("acquired lock\n");
+      lazyswitchuvm(p);
       p->state = RUNNING;
 
       // cprintf("scheduler switching to RUNNABLE process: %s at %d ticks\n", p->name, getticks());
       p->last_scheduled = getticks();
       
       cprintf("switching to PID: %d, entry_flag = %d\n", p->pid, entry_flag);
-      // release(&ptable.lock);
       swtch(&(c->scheduler), p->context);
-      // acquire(&ptable.lock);
       cprintf("got back from PID: %d, entry_flag = %d\n", p->pid, entry_flag);
 
       p->last_interrupted = getticks();
       p->runtime += p->last_interrupted - p->last_scheduled;
 
-      switchkvm();
+      // Stay on p's page table unless p is about to be freed.
+      if(p->state == ZOMBIE)
+        switchkvm();
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
       c->proc = 0;
-      cprintf("releasing lock\n");
-      release(&ptable.lock);
     }
+    cprintf("releasing lock\n");
+    release(&ptable.lock);
 
-    // cprintf("releasing lock\n");
-    // release(&ptable.lock);
+    // Nothing to run; use the idle time to pre-zero free pages.
+    if (heap.size == 0)
+      kzeroidle();
   }
 }
 
@@ -716,7 +868,7 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
+    cprintf("%d %s %s %d pages", p->pid, state, p->name, p->rss);
     if(p->state == SLEEPING){
       getcallerpcs((uint*)p->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
@@ -725,3 +877,52 @@ procdump(void)
     cprintf("\n");
   }
 }
+
+// Fill in ps with the state of every slot in the process table,
+// up to the fields that belong to the given layout version.
+// Returns the kernel's PSTAT_VERSION.
+int
+procstat(struct pstat *ps, int version)
+{
+  struct proc *p;
+  int i, live;
+
+  acquire(&ptable.lock);
+  for(i = 0; i < NPROC; i++){
+    p = &ptable.proc[i];
+    ps->inuse[i] = p->state != UNUSED;
+    ps->tickets[i] = p->tickets;
+    ps->pid[i] = p->pid;
+    ps->pass[i] = p->pass;
+    ps->remain[i] = p->remain;
+    ps->stride[i] = p->stride;
+    ps->rtime[i] = p->runtime;
+    if(version < 2)
+      continue;
+    // An embryo's pgdir is not set up yet.
+    live = p->state != UNUSED && p->state != EMBRYO && p->pgdir;
+    ps->sz[i] = live ? p->sz : 0;
+    ps->rss[i] = live ? p->rss : 0;
+    ps->ptpages[i] = live ? ptpages(p->pgdir) : 0;
+    ps->faults[i] = p->nfault;
+    ps->forks[i] = p->nfork;
+    ps->execs[i] = p->nexec;
+    ps->syscalls[i] = p->nsyscall;
+  }
+  release(&ptable.lock);
+  return PSTAT_VERSION;
+}
+
+// Bytes of struct pstat filled in for a layout version,
+// or -1 if the kernel does not know the version.
+int
+pstatsize(int version)
+{
+  switch(version){
+  case 1:
+    return PSTAT_V1SIZE;
+  case 2:
+    return PSTAT_V2SIZE;
+  }
+  return -1;
+}
@@ -11,6 +11,9 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  pde_t *pgdir;                // Process page table in cr3, or 0 for kpgdir
+  uint ncr3load;               // Number of cr3 loads
+  uint ncr3skip;               // Number of cr3 loads lazyswitchuvm skipped
 };
 
 extern struct cpu cpus[NCPU];
@@ -39,6 +42,26 @@ struct context {
   uint eip;
 };
 
+// A loadable segment of a program, paged in from the
+// executable on first touch.
+struct execseg {
+  uint va;                     // Start address, page aligned
+  uint off;                    // File offset of va
+  uint filesz;                 // Bytes read from the file; the rest is zero
+};
+
+// A memory mapping made by mmap().  See mmap.c.
+struct vma {
+  uint start;                  // First address, page aligned
+  uint end;                    // End address, page aligned
+  int prot;                    // PROT_READ, PROT_WRITE
+  int flags;                   // MAP_SHARED or MAP_PRIVATE, MAP_ANONYMOUS
+  struct file *f;              // Mapped file, 0 if anonymous
+  uint off;                    // File offset of start
+  struct shmseg *shm;          // Attached shared memory segment, or 0
+  struct vma *next;            // Next mapping, by address
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -56,6 +79,17 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  int rss;                     // User pages resident in pgdir
+  struct inode *exe;           // Executable, for demand paging
+  int nseg;                    // Number of segments in seg
+  struct execseg seg[MAXSEG];  // Segments paged in from exe
+  struct vma *vmas;            // mmap() regions, sorted by address
+  struct cpu *lastcpu;         // CPU that last switched to pgdir
+  uint nfault;                 // Page faults handled
+  uint nfork;                  // Children created by fork or spawn
+  uint nexec;                  // Successful execs
+  uint nsyscall;               // System calls made
+  void (*kfn)(void);           // Body of a kernel thread, or 0
 
   // stride scheduling
   int tickets;                 // number of tickets
@@ -68,9 +102,11 @@ struct proc {
 };
 
 // Process memory is laid out contiguously, low addresses first:
-//   text
-//   original data and bss
+//   text                   \ paged in from exe
+//   original data and bss  / on first touch
 //   fixed-size stack
-//   expandable heap
+//   expandable heap, mapped a page at a time on first touch
+//   ...
+//   mmap() regions, allocated downwards from KERNBASE
 
 #endif
\ No newline at end of file
@@ -0,0 +1,36 @@
+// List processes with their memory use and fault counts.
+// Columns: pid, size in bytes, resident pages, page table pages,
+// page faults, children forked, execs and system calls.
+//
+// usage: ps
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "pstat.h"
+
+struct pstat ps;
+
+int
+main(int argc, char *argv[])
+{
+  int i, version;
+
+  if((version = procstat(PSTAT_VERSION, &ps)) < 0){
+    printf(2, "ps: procstat failed\n");
+    exit();
+  }
+  if(version < PSTAT_VERSION)
+    printf(2, "ps: kernel pstat version %d is older than %d\n",
+           version, PSTAT_VERSION);
+
+  printf(1, "pid\tsz\trss\tpt\tfaults\tforks\texecs\tsyscalls\n");
+  for(i = 0; i < NPROC; i++){
+    if(!ps.inuse[i])
+      continue;
+    printf(1, "%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n", ps.pid[i], ps.sz[i],
+           ps.rss[i], ps.ptpages[i], ps.faults[i], ps.forks[i],
+           ps.execs[i], ps.syscalls[i]);
+  }
+  exit();
+}
@@ -3,6 +3,11 @@
 
 #include "param.h"
 
+// Layout version filled in by procstat(). Fields are only ever
+// appended, so a program asking for an older version gets a
+// prefix of the current structure.
+#define PSTAT_VERSION 2
+
 struct pstat {
   int inuse[NPROC];      // Whether this slot of the process table is in use (1 or 0)
   int tickets[NPROC];    // Number of tickets for each process
@@ -11,13 +16,29 @@ struct pstat {
   int remain[NPROC];     // Remain value of each process
   int stride[NPROC];     // Stride value for each process
   int rtime[NPROC];      // Total running time of each process
+
+  // Version 2: memory and fault accounting.
+  int sz[NPROC];         // Size of process memory (bytes)
+  int rss[NPROC];        // User pages resident in memory
+  int ptpages[NPROC];    // Page table pages, including the page directory
+  int faults[NPROC];     // Page faults handled
+  int forks[NPROC];      // Children created by fork() or spawn()
+  int execs[NPROC];      // Successful exec() calls
+  int syscalls[NPROC];   // System calls made
 };
 
-int getpinfo(struct pstat* a) {
+// Bytes of struct pstat filled in for each version.
+#define PSTAT_V1SIZE ((uint)&((struct pstat*)0)->sz)
+#define PSTAT_V2SIZE sizeof(struct pstat)
+
+// Stubs for programs written against the old interface.  Static
+// inline, so that every includer, the kernel too, gets its own
+// copy only if it uses them.
+static inline int getpinfo(struct pstat* a) {
     return 0;
 }
 
-int settickets(int n) {
+static inline int settickets(int n) {
     return 0;
 }
 
@@ -3,6 +3,7 @@
 #include "types.h"
 #include "user.h"
 #include "fcntl.h"
+#include "spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -52,6 +53,9 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+int simplecmd(char*);
+int spawncmd(struct cmd*);
+void freecmd(struct cmd*);
 
 // Execute cmd.  Never returns.
 void
@@ -145,7 +149,8 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  struct cmd *cmd;
+  int fd, n;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,6 +169,14 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
+    if(simplecmd(buf)){
+      // Start the command with spawn(); no need to fork the shell.
+      cmd = parsecmd(buf);
+      for(n = spawncmd(cmd); n > 0; n--)
+        wait();
+      freecmd(cmd);
+      continue;
+    }
     if(fork1() == 0)
       runcmd(parsecmd(buf));
     wait();
@@ -491,3 +504,95 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+//PAGEBREAK!
+// Spawning simple commands
+
+// Return 1 if buf holds a simple command or a pipe of two
+// simple commands, 0 otherwise.  parsecmd() cannot fail on
+// such a line, so the shell can parse it itself.
+int
+simplecmd(char *s)
+{
+  int npipe, nword, inword;
+
+  npipe = nword = inword = 0;
+  for(; *s; s++){
+    if(strchr("<>&;()", *s))
+      return 0;
+    if(*s == '|'){
+      if(nword == 0 || ++npipe > 1)
+        return 0;
+      nword = inword = 0;
+    } else if(strchr(whitespace, *s)){
+      inword = 0;
+    } else if(!inword){
+      inword = 1;
+      if(++nword >= MAXARGS)
+        return 0;
+    }
+  }
+  return nword > 0;
+}
+
+// Start a command accepted by simplecmd().
+// Returns the number of processes started.
+int
+spawncmd(struct cmd *cmd)
+{
+  struct execcmd *ecmd, *left, *right;
+  struct pipecmd *pcmd;
+  struct spawnfd fds[4];
+  int p[2], n;
+
+  if(cmd->type == EXEC){
+    ecmd = (struct execcmd*)cmd;
+    if(spawn(ecmd->argv[0], ecmd->argv, 0) < 0){
+      printf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+  }
+
+  pcmd = (struct pipecmd*)cmd;
+  left = (struct execcmd*)pcmd->left;
+  right = (struct execcmd*)pcmd->right;
+  if(pipe(p) < 0)
+    panic("pipe");
+  fds[1].fd = p[0];
+  fds[1].from = -1;
+  fds[2].fd = p[1];
+  fds[2].from = -1;
+  fds[3].fd = -1;
+
+  n = 0;
+  fds[0].fd = 1;
+  fds[0].from = p[1];
+  if(spawn(left->argv[0], left->argv, fds) < 0)
+    printf(2, "exec %s failed\n", left->argv[0]);
+  else
+    n++;
+  fds[0].fd = 0;
+  fds[0].from = p[0];
+  if(spawn(right->argv[0], right->argv, fds) < 0)
+    printf(2, "exec %s failed\n", right->argv[0]);
+  else
+    n++;
+  close(p[0]);
+  close(p[1]);
+  return n;
+}
+
+// Free a command accepted by simplecmd().
+void
+freecmd(struct cmd *cmd)
+{
+  struct pipecmd *pcmd;
+
+  if(cmd->type == PIPE){
+    pcmd = (struct pipecmd*)cmd;
+    free(pcmd->left);
+    free(pcmd->right);
+  }
+  free(cmd);
+}
@@ -0,0 +1,173 @@
+// Shared memory segments.
+//
+// shmget() finds or creates a segment of zeroed pages named by
+// a key, shmat() maps a segment into the calling process, and
+// shmdt() unmaps it again.  An attached segment is an mmap()
+// region (see mmap.c) whose pages come from the segment, so
+// fork(), exit() and exec() handle attachments like any other
+// shared mapping.
+//
+// The segment holds one reference to each of its pages, and
+// every mapping of a page holds another.  A segment is destroyed
+// when its last attachment goes away.  A segment that is not
+// attached when the process that created it exits is destroyed
+// then, so unused keys do not use up the table.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+struct shmseg {
+  int key;                // Key given to shmget; 0 if created private
+  int npages;             // Size in pages; 0 if slot unused
+  int nattach;            // Number of mappings of the segment
+  int creator;            // Pid of the process that created it
+  char *pages[SHMMAXPG];
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shmtable");
+}
+
+// Return the id of the segment for key, creating one of size
+// bytes if there is none or key is 0.  Returns -1 on error.
+int
+shmget(int key, uint size)
+{
+  struct shmseg *s, *free;
+  int i, npages;
+
+  npages = PGROUNDUP(size) / PGSIZE;
+  if(npages == 0 || npages > SHMMAXPG)
+    return -1;
+
+  acquire(&shmtable.lock);
+  free = 0;
+  for(s = shmtable.seg; s < &shmtable.seg[NSHM]; s++){
+    if(s->npages == 0){
+      if(free == 0)
+        free = s;
+    } else if(key != 0 && s->key == key){
+      i = npages > s->npages ? -1 : s - shmtable.seg;
+      release(&shmtable.lock);
+      return i;
+    }
+  }
+  if((s = free) == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+  for(i = 0; i < npages; i++){
+    if((s->pages[i] = kalloc_zeroed()) == 0){
+      while(--i >= 0)
+        kfree(s->pages[i]);
+      release(&shmtable.lock);
+      return -1;
+    }
+  }
+  s->key = key;
+  s->npages = npages;
+  s->nattach = 0;
+  s->creator = myproc()->pid;
+  release(&shmtable.lock);
+  return s - shmtable.seg;
+}
+
+// Map segment id into the current process.
+// Returns its address, or -1.
+int
+shmat(int id)
+{
+  struct shmseg *s;
+  int va;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shmtable.seg[id];
+  acquire(&shmtable.lock);
+  if(s->npages == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+  s->nattach++;
+  release(&shmtable.lock);
+  if((va = mmapshm(s, s->npages * PGSIZE)) < 0){
+    // Drop only this attachment; a segment nobody has mapped
+    // yet stays for its creator, as after shmget().
+    acquire(&shmtable.lock);
+    s->nattach--;
+    release(&shmtable.lock);
+  }
+  return va;
+}
+
+// Unmap the segment attached at va from the current process.
+int
+shmdt(uint va)
+{
+  struct vma *v;
+
+  if((v = findvma(myproc(), va)) == 0 || v->shm == 0 || v->start != va)
+    return -1;
+  return munmap(v->start, v->end - v->start);
+}
+
+// Return the page at offset off of segment s.
+char*
+shmpage(struct shmseg *s, uint off)
+{
+  return s->pages[off / PGSIZE];
+}
+
+// Record another mapping of segment s.
+void
+shmdup(struct shmseg *s)
+{
+  acquire(&shmtable.lock);
+  s->nattach++;
+  release(&shmtable.lock);
+}
+
+// Destroy the segments that p created and that nobody has
+// attached.  Called by exit() after p's mappings are gone.
+void
+shmexit(struct proc *p)
+{
+  struct shmseg *s;
+  int i;
+
+  acquire(&shmtable.lock);
+  for(s = shmtable.seg; s < &shmtable.seg[NSHM]; s++){
+    if(s->npages == 0 || s->nattach > 0 || s->creator != p->pid)
+      continue;
+    for(i = 0; i < s->npages; i++)
+      kfree(s->pages[i]);
+    s->npages = 0;
+  }
+  release(&shmtable.lock);
+}
+
+// Drop a mapping of segment s, destroying it if it was the last.
+void
+shmput(struct shmseg *s)
+{
+  int i;
+
+  acquire(&shmtable.lock);
+  if(--s->nattach == 0){
+    for(i = 0; i < s->npages; i++)
+      kfree(s->pages[i]);
+    s->npages = 0;
+  }
+  release(&shmtable.lock);
+}
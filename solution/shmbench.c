@@ -0,0 +1,121 @@
+// Shared memory ring benchmark.
+// A child sends data to its parent through a single-producer,
+// single-consumer ring in a shared memory segment, which needs
+// no system calls on the data path, and then sends the same
+// amount through a pipe for comparison.  The ring spins when
+// full or empty, so it wants at least two CPUs.
+//
+// usage: shmbench [kbytes]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NKB      1024
+#define RINGSIZE 32768   // power of two
+#define CHUNK    512
+#define SHMKEY   0x5348
+
+struct ring {
+  volatile uint head;  // bytes written by producer
+  volatile uint tail;  // bytes consumed by consumer
+  char data[RINGSIZE];
+};
+
+char buf[CHUNK];
+
+void
+produce(struct ring *r, uint total)
+{
+  uint sent, n, i, h;
+
+  for(sent = 0; sent < total; sent += n){
+    n = total - sent;
+    if(n > CHUNK)
+      n = CHUNK;
+    while(RINGSIZE - (r->head - r->tail) < n)
+      ;
+    h = r->head;
+    for(i = 0; i < n; i++)
+      r->data[(h + i) & (RINGSIZE-1)] = sent + i;
+    __sync_synchronize();  // data before head
+    r->head = h + n;
+  }
+}
+
+// Returns the number of bytes that arrived wrong.
+int
+consume(struct ring *r, uint total)
+{
+  uint got, n, i, t;
+  int bad;
+
+  bad = 0;
+  for(got = 0; got < total; got += n){
+    while((n = r->head - r->tail) == 0)
+      ;
+    __sync_synchronize();  // head before data
+    t = r->tail;
+    for(i = 0; i < n; i++)
+      if(r->data[(t + i) & (RINGSIZE-1)] != (char)(got + i))
+        bad++;
+    __sync_synchronize();  // data before tail
+    r->tail = t + n;
+  }
+  return bad;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct ring *r;
+  int id, p[2], n, bad, start, tring, tpipe;
+  uint total, got;
+
+  total = NKB * 1024;
+  if(argc > 1)
+    total = atoi(argv[1]) * 1024;
+
+  if((id = shmget(SHMKEY, sizeof(struct ring))) < 0 ||
+     (r = shmat(id)) == (struct ring*)-1){
+    printf(1, "shmbench: cannot get shared memory\n");
+    exit();
+  }
+  r->head = r->tail = 0;
+
+  start = uptime();
+  if(fork() == 0){
+    produce(r, total);
+    exit();
+  }
+  bad = consume(r, total);
+  wait();
+  tring = uptime() - start;
+  shmdt(r);
+
+  if(pipe(p) < 0){
+    printf(1, "shmbench: pipe failed\n");
+    exit();
+  }
+  start = uptime();
+  if(fork() == 0){
+    close(p[0]);
+    for(got = 0; got < total; got += CHUNK)
+      write(p[1], buf, CHUNK);
+    exit();
+  }
+  close(p[1]);
+  for(got = 0; (n = read(p[0], buf, sizeof(buf))) > 0; got += n)
+    ;
+  close(p[0]);
+  wait();
+  tpipe = uptime() - start;
+
+  printf(1, "shmbench: %d KB through shared ring in %d ticks, pipe in %d ticks\n",
+         total / 1024, tring, tpipe);
+  if(bad)
+    printf(1, "shmbench: %d bytes arrived wrong through the ring\n", bad);
+  if(got != total)
+    printf(1, "shmbench: pipe delivered %d of %d bytes\n", got, total);
+  exit();
+}
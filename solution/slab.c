@@ -0,0 +1,214 @@
+// Slab allocator for small kernel objects (pipes, files, inodes).
+//
+// Each kmem_cache hands out objects of one size, carved out of
+// 4096-byte slab pages obtained from kalloc(). A slab page starts
+// with a struct slab header followed by as many objects as fit;
+// free objects in a slab are linked through their first word.
+//
+// In front of the slabs, every CPU keeps up to SLABCPUMAX free
+// objects that kmem_cache_alloc() and kmem_cache_free() use with
+// interrupts off and without taking the cache lock. Objects move
+// between a CPU and the slabs SLABBATCH at a time.
+//
+// The constructor, if any, runs whenever an object is taken out
+// of its slab. Objects recycled through a CPU's cache skip it, so
+// callers must free objects in their constructed state (e.g. with
+// locks released).
+//
+// A cache keeps at most one empty slab; further slabs that become
+// empty are given back to kalloc().
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+
+#define SLABBATCH (SLABCPUMAX/2)  // objects moved per refill/drain
+
+struct slab {
+  struct slab *next;
+  struct slab *prev;
+  void *freelist;  // free objects in this slab
+  int inuse;       // objects not on freelist
+};
+
+// List of all caches, for statistics.
+static struct kmem_cache *caches;
+
+static void
+slabunlink(struct slab **head, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *head = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+static void
+slabpush(struct slab **head, struct slab *s)
+{
+  s->prev = 0;
+  s->next = *head;
+  if(*head)
+    (*head)->prev = s;
+  *head = s;
+}
+
+// Set up cache c for objects of size bytes.
+// Called once per cache during boot.
+void
+kmem_cache_init(struct kmem_cache *c, char *name, uint size,
+                void (*ctor)(void*))
+{
+  memset(c, 0, sizeof(*c));
+  c->name = name;
+  c->size = (size + 3) & ~3;
+  if(c->size < sizeof(void*))
+    c->size = sizeof(void*);
+  c->perslab = (PGSIZE - sizeof(struct slab)) / c->size;
+  if(c->perslab < 1)
+    panic("kmem_cache_init: object too big");
+  c->ctor = ctor;
+  initlock(&c->lock, name);
+  c->next = caches;
+  caches = c;
+}
+
+// Allocate a new slab page for c and put it on c->partial.
+// Caller must hold c->lock.
+static struct slab*
+slabgrow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->freelist = 0;
+  s->inuse = 0;
+  obj = (char*)(s + 1) + (c->perslab - 1) * c->size;
+  for(i = 0; i < c->perslab; i++, obj -= c->size){
+    *(void**)obj = s->freelist;
+    s->freelist = obj;
+  }
+  slabpush(&c->partial, s);
+  c->nslab++;
+  c->nempty++;
+  return s;
+}
+
+// Take one object out of the slabs of c, growing c if needed.
+// Caller must hold c->lock.
+static void*
+slabtake(struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  if((s = c->partial) == 0 && (s = slabgrow(c)) == 0)
+    return 0;
+  obj = s->freelist;
+  s->freelist = *(void**)obj;
+  if(s->inuse++ == 0)
+    c->nempty--;
+  if(s->freelist == 0){
+    slabunlink(&c->partial, s);
+    slabpush(&c->full, s);
+  }
+  c->ninuse++;
+  if(c->ctor)
+    c->ctor(obj);
+  return obj;
+}
+
+// Return obj to its slab in c.
+// Caller must hold c->lock.
+static void
+slabput(struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)obj);
+  if(s->freelist == 0){
+    slabunlink(&c->full, s);
+    slabpush(&c->partial, s);
+  }
+  *(void**)obj = s->freelist;
+  s->freelist = obj;
+  c->ninuse--;
+  if(--s->inuse == 0){
+    if(c->nempty > 0){
+      slabunlink(&c->partial, s);
+      c->nslab--;
+      kfree((char*)s);
+    } else
+      c->nempty++;
+  }
+}
+
+// Allocate an object from cache c.
+// Returns 0 if the memory cannot be allocated.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct slabcpu *sc;
+  void *obj;
+  int i;
+
+  pushcli();
+  sc = &c->cpu[cpuid()];
+  if(sc->n == 0){
+    acquire(&c->lock);
+    for(i = 0; i < SLABBATCH; i++){
+      if((obj = slabtake(c)) == 0)
+        break;
+      sc->obj[sc->n++] = obj;
+    }
+    release(&c->lock);
+  }
+  obj = 0;
+  if(sc->n > 0)
+    obj = sc->obj[--sc->n];
+  popcli();
+  return obj;
+}
+
+// Free an object previously returned by kmem_cache_alloc(c).
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct slabcpu *sc;
+  int i;
+
+  if(obj == 0)
+    panic("kmem_cache_free");
+
+  pushcli();
+  sc = &c->cpu[cpuid()];
+  if(sc->n == SLABCPUMAX){
+    acquire(&c->lock);
+    for(i = 0; i < SLABBATCH; i++)
+      slabput(c, sc->obj[--sc->n]);
+    release(&c->lock);
+  }
+  sc->obj[sc->n++] = obj;
+  popcli();
+}
+
+// Total pages held by all slab caches.
+int
+slabpages(void)
+{
+  struct kmem_cache *c;
+  int n;
+
+  n = 0;
+  for(c = caches; c; c = c->next)
+    n += c->nslab;
+  return n;
+}
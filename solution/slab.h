@@ -0,0 +1,25 @@
+// Object cache for small, fixed-size kernel objects.
+// See slab.c.
+
+#define SLABCPUMAX 16  // free objects held per CPU
+
+// Free objects cached by one CPU.
+struct slabcpu {
+  int n;
+  void *obj[SLABCPUMAX];
+};
+
+struct kmem_cache {
+  char *name;              // Name of cache (for debugging)
+  uint size;               // Object size in bytes
+  int perslab;             // Objects per slab page
+  void (*ctor)(void*);     // Constructor, may be 0
+  struct spinlock lock;    // Protects the fields below
+  struct slab *partial;    // Slabs with free objects
+  struct slab *full;       // Slabs with no free objects
+  int nslab;               // Pages held by this cache
+  int nempty;              // Slabs with no objects in use
+  int ninuse;              // Objects handed out of slabs
+  struct kmem_cache *next; // Next cache in list of all caches
+  struct slabcpu cpu[NCPU];
+};
@@ -0,0 +1,7 @@
+// File descriptor action for spawn(): the child gets the
+// parent's descriptor from as its descriptor fd, or has fd
+// closed if from is -1.  A list of actions ends with fd == -1.
+struct spawnfd {
+  int fd;
+  int from;
+};
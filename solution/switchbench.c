@@ -0,0 +1,68 @@
+// Context switch benchmark.
+// Bounces a byte between two processes through a pair of pipes,
+// then spins alone so that the timer keeps preempting it and the
+// scheduler keeps choosing it again.  Reports how many page table
+// switches (each a full TLB flush) each phase cost, and how many
+// the scheduler skipped.
+//
+// usage: switchbench [round-trips [spin-ticks]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "memstat.h"
+
+#define NROUND 1000
+#define NSPIN  100
+
+void
+report(char *what, int ticks, struct memstat *before, struct memstat *after)
+{
+  printf(1, "switchbench: %s: %d ticks, %d page table loads, %d skipped\n",
+         what, ticks, after->cr3loads - before->cr3loads,
+         after->cr3skips - before->cr3skips);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat before, after;
+  int i, nround, nspin, start, ping[2], pong[2];
+  char c;
+
+  nround = NROUND;
+  nspin = NSPIN;
+  if(argc > 1)
+    nround = atoi(argv[1]);
+  if(argc > 2)
+    nspin = atoi(argv[2]);
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf(1, "switchbench: pipe failed\n");
+    exit();
+  }
+  getmemstat(&before);
+  start = uptime();
+  if(fork() == 0){
+    for(i = 0; i < nround; i++){
+      read(ping[0], &c, 1);
+      write(pong[1], &c, 1);
+    }
+    exit();
+  }
+  for(i = 0; i < nround; i++){
+    write(ping[1], &c, 1);
+    read(pong[0], &c, 1);
+  }
+  wait();
+  getmemstat(&after);
+  report("ping-pong", uptime() - start, &before, &after);
+
+  getmemstat(&before);
+  start = uptime();
+  while(uptime() - start < nspin)
+    ;
+  getmemstat(&after);
+  report("spin", nspin, &before, &after);
+  exit();
+}
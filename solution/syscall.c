@@ -63,16 +63,38 @@ argptr(int n, char **pp, int size)
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || (uint)i+size < (uint)i)
+    return -1;
+  if(((uint)i >= curproc->sz || (uint)i+size > curproc->sz) &&
+     !inmmap(curproc, i, size))
+    return -1;
+  if(faultin(i, size) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes that the kernel will write.
+// Like argptr, but also check that the memory is writable.
+int
+argwptr(int n, char **pp, int size)
+{
+  if(argptr(n, pp, size) < 0)
+    return -1;
+  if(!writableuvm((uint)*pp, size))
+    return -1;
+  return 0;
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// The kernel uses the string in place, so another process must not
+// be able to change it after this check.  MAP_SHARED mappings and
+// shm segments can be written by other processes, but they always
+// lie above p->sz (see vmaplace and growproc), and fetchstr() only
+// accepts a string that ends below p->sz, in private memory.  If
+// strings are ever taken from shared mappings, copy them first.
 int
 argstr(int n, char **pp)
 {
@@ -103,6 +125,16 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_getmemstat(void);
+extern int sys_spawn(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_procstat(void);
+extern int sys_getfsstat(void);
+extern int sys_fsync(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -126,6 +158,16 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_getmemstat] sys_getmemstat,
+[SYS_spawn]   sys_spawn,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_shmget]  sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_procstat] sys_procstat,
+[SYS_getfsstat] sys_getfsstat,
+[SYS_fsync]  sys_fsync,
 };
 
 void
@@ -20,3 +20,13 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_getmemstat 22
+#define SYS_spawn  23
+#define SYS_mmap   24
+#define SYS_munmap 25
+#define SYS_shmget 26
+#define SYS_shmat  27
+#define SYS_shmdt  28
+#define SYS_procstat 29
+#define SYS_getfsstat 30
+#define SYS_fsync  31
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "memstat.h"
 
 int
 sys_fork(void)
@@ -89,3 +90,67 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// Copy physical page allocator and page table statistics
+// to user space.
+int
+sys_getmemstat(void)
+{
+  struct memstat *ms;
+
+  if(argwptr(0, (void*)&ms, sizeof(*ms)) < 0)
+    return -1;
+  kmemstat(ms);
+  vmstat(ms);
+  return 0;
+}
+
+// Return the id of the shared memory segment for a key,
+// creating it with the given size if needed.
+int
+sys_shmget(void)
+{
+  int key, size;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0)
+    return -1;
+  if(size <= 0)
+    return -1;
+  return shmget(key, size);
+}
+
+int
+sys_shmat(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return shmat(id);
+}
+
+int
+sys_shmdt(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return shmdt(addr);
+}
+
+// Copy the process table, in the given struct pstat layout
+// version, to user space.  Returns the kernel's layout version,
+// so callers can tell which fields it knows about.
+int
+sys_procstat(void)
+{
+  struct pstat *ps;
+  int version, size;
+
+  if(argint(0, &version) < 0 || (size = pstatsize(version)) < 0)
+    return -1;
+  if(argwptr(1, (void*)&ps, size) < 0)
+    return -1;
+  return procstat(ps, version);
+}
@@ -40,6 +40,7 @@ trap(struct trapframe *tf)
     if(myproc()->killed)
       exit();
     myproc()->tf = tf;
+    myproc()->nsyscall++;
     syscall();
     if(myproc()->killed)
       exit();
@@ -78,8 +79,22 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // Copy-on-write and other recoverable faults; fall
+    // through to the error handling below if it is not one.
+    if(pagefault(rcr2(), tf->err) == 0){
+      myproc()->nfault++;
+      break;
+    }
+
   //PAGEBREAK: 13
   default:
+    if(tf->trapno == T_IRQ0 + ideirq && ideirq != IRQ_IDE){
+      // Disk on a PCI interrupt line, such as virtio-blk.
+      ideintr();
+      lapiceoi();
+      break;
+    }
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
@@ -1,5 +1,9 @@
 struct stat;
 struct rtcdate;
+struct memstat;
+struct spawnfd;
+struct pstat;
+struct fsstat;
 
 // system calls
 int fork(void);
@@ -23,6 +27,16 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int getmemstat(struct memstat*);
+int spawn(char*, char**, struct spawnfd*);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int shmget(int, int);
+void* shmat(int);
+int shmdt(void*);
+int procstat(int, struct pstat*);
+int getfsstat(struct fsstat*);
+int fsync(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -931,6 +931,87 @@ bigdir(void)
   printf(1, "bigdir ok\n");
 }
 
+// Fill one directory well past its first block, so that it is
+// hashed and its leaves and index split, and look names up in it
+// after each step.
+void
+hashdir(void)
+{
+  int i, fd;
+  char name[8];
+
+  printf(1, "hashdir test\n");
+  if(mkdir("hd") != 0 || chdir("hd") != 0){
+    printf(1, "hashdir mkdir failed\n");
+    exit();
+  }
+
+  for(i = 0; i < 600; i++){
+    name[0] = 'h';
+    name[1] = '0' + (i / 64);
+    name[2] = '0' + (i % 64);
+    name[3] = '\0';
+    if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+      printf(1, "hashdir create %d failed\n", i);
+      exit();
+    }
+    close(fd);
+    if(i % 50 == 0){
+      name[0] = 'd';
+      if(mkdir(name) != 0){
+        printf(1, "hashdir mkdir %d failed\n", i);
+        exit();
+      }
+    }
+  }
+
+  for(i = 0; i < 600; i++){
+    name[0] = 'h';
+    name[1] = '0' + (i / 64);
+    name[2] = '0' + (i % 64);
+    name[3] = '\0';
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf(1, "hashdir open %d failed\n", i);
+      exit();
+    }
+    close(fd);
+    name[0] = 'm';
+    if(open(name, O_RDONLY) >= 0){
+      printf(1, "hashdir found missing %d\n", i);
+      exit();
+    }
+  }
+  if((fd = open(".", O_RDONLY)) < 0 || close(fd) != 0 ||
+     (fd = open("..", O_RDONLY)) < 0 || close(fd) != 0){
+    printf(1, "hashdir dot lookup failed\n");
+    exit();
+  }
+
+  for(i = 0; i < 600; i++){
+    name[0] = 'h';
+    name[1] = '0' + (i / 64);
+    name[2] = '0' + (i % 64);
+    name[3] = '\0';
+    if(unlink(name) != 0){
+      printf(1, "hashdir unlink %d failed\n", i);
+      exit();
+    }
+    if(i % 50 == 0){
+      name[0] = 'd';
+      if(unlink(name) != 0){
+        printf(1, "hashdir rmdir %d failed\n", i);
+        exit();
+      }
+    }
+  }
+
+  if(chdir("..") != 0 || unlink("hd") != 0){
+    printf(1, "hashdir unlink hd failed\n");
+    exit();
+  }
+  printf(1, "hashdir ok\n");
+}
+
 void
 subdir(void)
 {
@@ -1794,6 +1875,7 @@ main(int argc, char *argv[])
   iref();
   forktest();
   bigdir(); // slow
+  hashdir(); // slow
 
   uio();
 
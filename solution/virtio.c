@@ -0,0 +1,241 @@
+// Virtio-blk disk driver for the file system disk.
+// A drop-in replacement for ide.c (like memide.c), chosen with
+// DISK=virtio in the Makefile; the boot disk stays on IDE.
+//
+// The device has one virtqueue.  Up to NVREQ requests can be
+// outstanding at a time, each a chain of descriptors: the
+// request header, one descriptor per block, and a status byte.
+// Bufs that find all requests busy wait on vqueue; when a
+// request slot frees up, a run of waiting bufs for consecutive
+// blocks in the same direction goes out as one request of up
+// to VMAXBLK blocks.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "virtio.h"
+#include "fsstat.h"
+
+#define NVREQ    8   // most requests outstanding
+#define VMAXBLK  8   // most blocks per request
+#define VNDESC   (VMAXBLK+2)  // descriptors per request
+
+// A request slot.  Slot i owns descriptors i*VNDESC and up.
+struct vreq {
+  struct virtio_blk_req hdr;
+  uchar status;
+  int n;                      // bufs in the request, 0 if slot is free
+  struct buf *b[VMAXBLK];
+};
+
+int ideirq;                   // interrupt line, for trap()
+
+static struct spinlock vlock;
+static ushort vbase;          // I/O base of legacy registers
+static uint vcapacity;        // disk size in blocks
+static int vqsize;            // descriptors in the virtqueue
+static struct vring_desc *vdesc;
+static struct vring_avail *vavail;
+static volatile struct vring_used *vused;
+static ushort vusedidx;       // next vused->ring entry to look at
+static struct vreq vreqs[NVREQ];
+static struct buf *vqueue;    // bufs waiting for a request slot
+static uint vcmds;            // requests issued
+static uint vblks;            // blocks transferred
+
+void
+ideinit(void)
+{
+  struct pcidev d;
+  uint size;
+  int order;
+  char *ring;
+
+  initlock(&vlock, "virtio");
+  if(pcifind(VIRTIO_VENDOR, VIRTIO_DEV_BLK, 0, 0, &d) < 0)
+    panic("virtio: no disk");
+  if((d.bar[0] & 1) == 0)
+    panic("virtio: no legacy I/O registers");
+  pcienable(&d);
+  vbase = d.bar[0] & ~3;
+
+  // Reset, then acknowledge the device.  No optional features.
+  outb(vbase+VIRTIO_STATUS, 0);
+  outb(vbase+VIRTIO_STATUS, VIRTIO_STAT_ACK);
+  outb(vbase+VIRTIO_STATUS, VIRTIO_STAT_ACK|VIRTIO_STAT_DRIVER);
+  outl(vbase+VIRTIO_GUEST_FEAT, 0);
+  vcapacity = inl(vbase+VIRTIO_BLK_CAPACITY) / (BSIZE/512);
+
+  // Lay out queue 0: descriptors, then the available ring,
+  // then the used ring on the next page boundary.
+  outw(vbase+VIRTIO_QUEUE_SEL, 0);
+  vqsize = inw(vbase+VIRTIO_QUEUE_SIZE);
+  if(vqsize < NVREQ*VNDESC)
+    panic("virtio: queue too small");
+  size = PGROUNDUP(sizeof(struct vring_desc)*vqsize + sizeof(ushort)*(3+vqsize)) +
+         PGROUNDUP(sizeof(ushort)*3 + sizeof(struct vring_used_elem)*vqsize);
+  for(order = 0; (PGSIZE << order) < size; order++)
+    ;
+  if((ring = kallocpages(order)) == 0)
+    panic("virtio: no memory");
+  memset(ring, 0, PGSIZE << order);
+  vdesc = (struct vring_desc*)ring;
+  vavail = (struct vring_avail*)(ring + sizeof(struct vring_desc)*vqsize);
+  vused = (struct vring_used*)(ring +
+    PGROUNDUP(sizeof(struct vring_desc)*vqsize + sizeof(ushort)*(3+vqsize)));
+  outl(vbase+VIRTIO_QUEUE_PFN, V2P(ring) >> 12);
+
+  outb(vbase+VIRTIO_STATUS,
+       VIRTIO_STAT_ACK|VIRTIO_STAT_DRIVER|VIRTIO_STAT_DRIVER_OK);
+
+  ideirq = d.irq;
+  ioapicenable(ideirq, ncpu - 1);
+  cprintf("virtio: disk of %d blocks at 0x%x, irq %d\n",
+          vcapacity, vbase, ideirq);
+}
+
+// Hand waiting bufs to the device while there are free
+// request slots.  Caller must hold vlock.
+static void
+vstart(void)
+{
+  struct vreq *r;
+  struct vring_desc *d;
+  struct buf *b;
+  int i, n, slot, write;
+
+  for(slot = 0; vqueue && slot < NVREQ; slot++){
+    r = &vreqs[slot];
+    if(r->n)
+      continue;
+
+    // Take a run of bufs for consecutive blocks.
+    b = vqueue;
+    write = b->flags & B_DIRTY;
+    n = 0;
+    do {
+      r->b[n++] = vqueue;
+      vqueue = vqueue->qnext;
+    } while(n < VMAXBLK && vqueue && vqueue->dev == b->dev &&
+            vqueue->blockno == r->b[n-1]->blockno + 1 &&
+            (vqueue->flags & B_DIRTY) == write);
+    r->n = n;
+
+    r->hdr.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    r->hdr.reserved = 0;
+    r->hdr.sector = b->blockno * (BSIZE/512);
+    r->hdr.sectorhi = 0;
+    r->status = 0xff;
+
+    d = &vdesc[slot*VNDESC];
+    d[0].addr = V2P(&r->hdr);
+    d[0].len = sizeof(r->hdr);
+    d[0].flags = VRING_DESC_F_NEXT;
+    for(i = 0; i < n; i++){
+      d[1+i].addr = V2P(r->b[i]->data);
+      d[1+i].len = BSIZE;
+      d[1+i].flags = VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE);
+    }
+    d[1+n].addr = V2P(&r->status);
+    d[1+n].len = 1;
+    d[1+n].flags = VRING_DESC_F_WRITE;
+    for(i = 0; i < 1+n; i++)
+      d[i].next = slot*VNDESC + i + 1;
+
+    vavail->ring[vavail->idx % vqsize] = slot*VNDESC;
+    __sync_synchronize();
+    vavail->idx++;
+    __sync_synchronize();
+    outw(vbase+VIRTIO_QUEUE_NOTIFY, 0);
+    vcmds++;
+    vblks += n;
+  }
+}
+
+// Interrupt handler.
+void
+ideintr(void)
+{
+  struct vreq *r;
+  struct buf *b;
+  int i;
+
+  acquire(&vlock);
+  inb(vbase+VIRTIO_ISR);  // acknowledge
+
+  while(vusedidx != vused->idx){
+    __sync_synchronize();
+    r = &vreqs[vused->ring[vusedidx % vqsize].id / VNDESC];
+    if(r->status != VIRTIO_BLK_S_OK)
+      panic("virtio: I/O error");
+    for(i = 0; i < r->n; i++){
+      b = r->b[i];
+      b->flags |= B_VALID;
+      b->flags &= ~B_DIRTY;
+      if(b->flags & B_ASYNC)
+        bdone(b);
+      else
+        wakeup(b);
+    }
+    r->n = 0;
+    vusedidx++;
+  }
+  vstart();
+
+  release(&vlock);
+}
+
+//PAGEBREAK!
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, return without waiting; ideintr() hands
+// the buf to bdone() when the read is done.
+void
+iderw(struct buf *b)
+{
+  struct buf **pp;
+
+  if(!holdingsleep(&b->lock))
+    panic("iderw: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("iderw: nothing to do");
+  if(b->dev != ROOTDEV)
+    panic("iderw: request not for disk 1");
+  if(b->blockno >= vcapacity)
+    panic("iderw: block out of range");
+
+  acquire(&vlock);
+
+  b->qnext = 0;
+  for(pp=&vqueue; *pp; pp=&(*pp)->qnext)
+    ;
+  *pp = b;
+  vstart();
+
+  while((b->flags & B_ASYNC) == 0 && (b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &vlock);
+
+  release(&vlock);
+}
+
+// Fill in disk statistics for getfsstat().
+void
+idestat(struct fsstat *fs)
+{
+  acquire(&vlock);
+  fs->diskdma = 1;
+  fs->diskcmds = vcmds;
+  fs->diskblocks = vblks;
+  release(&vlock);
+}
@@ -0,0 +1,67 @@
+// Legacy ("transitional") virtio over PCI, as implemented by
+// QEMU's virtio-blk-pci.  See the virtio 1.0 specification,
+// sections 2.4 (virtqueues), 4.1.4.8 (legacy PCI registers)
+// and 5.2 (block device).
+
+#define VIRTIO_VENDOR        0x1af4
+#define VIRTIO_DEV_BLK       0x1001  // legacy block device
+
+// Legacy registers, as offsets from the I/O space in BAR 0.
+#define VIRTIO_FEATURES      0x00  // device features (32 bits)
+#define VIRTIO_GUEST_FEAT    0x04  // driver features (32 bits)
+#define VIRTIO_QUEUE_PFN     0x08  // queue address / 4096 (32 bits)
+#define VIRTIO_QUEUE_SIZE    0x0c  // descriptors in queue (16 bits)
+#define VIRTIO_QUEUE_SEL     0x0e  // queue selector (16 bits)
+#define VIRTIO_QUEUE_NOTIFY  0x10  // queue notifier (16 bits)
+#define VIRTIO_STATUS        0x12  // device status (8 bits)
+#define VIRTIO_ISR           0x13  // interrupt status, read to ack (8 bits)
+#define VIRTIO_BLK_CAPACITY  0x14  // disk size in 512-byte sectors (64 bits)
+
+// Device status bits.
+#define VIRTIO_STAT_ACK      1
+#define VIRTIO_STAT_DRIVER   2
+#define VIRTIO_STAT_DRIVER_OK 4
+#define VIRTIO_STAT_FAILED   128
+
+// Virtqueue descriptor.
+struct vring_desc {
+  uint addr;      // physical address, low 32 bits
+  uint addrhi;    // physical address, high 32 bits
+  uint len;
+  ushort flags;
+  ushort next;
+};
+#define VRING_DESC_F_NEXT    1  // chained with next
+#define VRING_DESC_F_WRITE   2  // device writes (vs reads)
+
+// Ring of descriptor chains the driver hands to the device.
+struct vring_avail {
+  ushort flags;
+  ushort idx;     // where the driver puts the next entry
+  ushort ring[];
+};
+
+// Ring of descriptor chains the device has finished.
+struct vring_used_elem {
+  uint id;        // head of the finished chain
+  uint len;
+};
+
+struct vring_used {
+  ushort flags;
+  ushort idx;     // where the device puts the next entry
+  struct vring_used_elem ring[];
+};
+
+// Block request header, the first descriptor of each chain.
+// The data descriptors follow, then a one-byte status that
+// the device writes.
+struct virtio_blk_req {
+  uint type;
+  uint reserved;
+  uint sector;    // low 32 bits
+  uint sectorhi;
+};
+#define VIRTIO_BLK_T_IN      0  // read the disk
+#define VIRTIO_BLK_T_OUT     1  // write the disk
+#define VIRTIO_BLK_S_OK      0
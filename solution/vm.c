@@ -6,6 +6,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "memstat.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -32,7 +33,7 @@ seginit(void)
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page table pages.
-static pte_t *
+pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
   pde_t *pde;
@@ -42,10 +43,9 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
+    // kalloc_zeroed() makes sure all those PTE_P bits are zero.
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
       return 0;
-    // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -57,7 +57,7 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned.
-static int
+int
 mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 {
   char *a, *last;
@@ -96,6 +96,10 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
+// The page table pages for the kernel's part are built once by
+// kvmalloc() and shared by every page table, since the kernel
+// mappings never change after boot.
+//
 // The kernel allocates physical memory for its heap and for user memory
 // between V2P(end) and the end of physical memory (PHYSTOP)
 // (directly addressable from end..P2V(PHYSTOP)).
@@ -114,48 +118,75 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
+// Set up kernel part of a page table by pointing its upper
+// page directory entries at kpgdir's page table pages.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes, and build the kernel page table
+// pages that all other page tables share.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
-  switchkvm();
+  struct kmap *k;
+
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  if((kpgdir = (pde_t*)kalloc_zeroed()) == 0)
+    panic("kvmalloc");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mappages(kpgdir, k->virt, k->phys_end - k->phys_start,
+                (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
+  lcr3(V2P(kpgdir));
 }
 
-// Switch h/w page table register to the kernel-only page table,
-// for when no process is running.
+// Load pgdir, or kpgdir if pgdir is 0, into this CPU's cr3.
+// The CPU holds a reference to a loaded process page directory,
+// so that freevm() cannot free the address space under a CPU
+// that is still using it after switching away lazily; if the
+// process freed it meanwhile, dropping that reference frees it.
+// Interrupts must be off.
+static void
+loadpgdir(struct cpu *c, pde_t *pgdir)
+{
+  pde_t *old;
+
+  old = c->pgdir;
+  if(pgdir)
+    kref((char*)pgdir);
+  c->pgdir = pgdir;
+  lcr3(V2P(pgdir ? pgdir : kpgdir));
+  c->ncr3load++;
+  if(old)
+    freevm(old);
+}
+
+// Switch h/w page table register to the kernel-only page table.
 void
 switchkvm(void)
 {
-  lcr3(V2P(kpgdir));   // switch to the kernel page table
+  pushcli();
+  loadpgdir(mycpu(), 0);
+  popcli();
 }
 
 // Switch TSS and h/w page table to correspond to process p.
 void
 switchuvm(struct proc *p)
 {
+  struct cpu *c;
+
   if(p == 0)
     panic("switchuvm: no process");
   if(p->kstack == 0)
@@ -164,17 +195,52 @@ switchuvm(struct proc *p)
     panic("switchuvm: no pgdir");
 
   pushcli();
-  mycpu()->gdt[SEG_TSS] = SEG16(STS_T32A, &mycpu()->ts,
-                                sizeof(mycpu()->ts)-1, 0);
-  mycpu()->gdt[SEG_TSS].s = 0;
-  mycpu()->ts.ss0 = SEG_KDATA << 3;
-  mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
+  c = mycpu();
+  c->gdt[SEG_TSS] = SEG16(STS_T32A, &c->ts, sizeof(c->ts)-1, 0);
+  c->gdt[SEG_TSS].s = 0;
+  c->ts.ss0 = SEG_KDATA << 3;
+  c->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
   // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
   // forbids I/O instructions (e.g., inb and outb) from user space
-  mycpu()->ts.iomb = (ushort) 0xFFFF;
+  c->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
-  lcr3(V2P(p->pgdir));  // switch to process's address space
+  loadpgdir(c, p->pgdir);  // switch to process's address space
+  p->lastcpu = c;
+  popcli();
+}
+
+// Switch to process p for the scheduler.  The scheduler does
+// not switch back to kpgdir after a process runs, so if this
+// CPU last ran p and p has not run anywhere else since, p's
+// page table and TSS setup are still loaded, with no stale TLB
+// entries, and the reload is skipped.
+void
+lazyswitchuvm(struct proc *p)
+{
+  struct cpu *c;
+
+  pushcli();
+  c = mycpu();
+  if(c->pgdir == p->pgdir && p->lastcpu == c){
+    c->ncr3skip++;
+    popcli();
+    return;
+  }
   popcli();
+  switchuvm(p);
+}
+
+// Fill in ms's page table switch counters.
+void
+vmstat(struct memstat *ms)
+{
+  struct cpu *c;
+
+  ms->cr3loads = ms->cr3skips = 0;
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    ms->cr3loads += c->ncr3load;
+    ms->cr3skips += c->ncr3skip;
+  }
 }
 
 // Load the initcode into address 0 of pgdir.
@@ -186,8 +252,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -231,13 +296,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -279,7 +343,11 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part.  The kernel part's page table pages
+// are shared and stay.  If a CPU still has pgdir loaded
+// (see loadpgdir), only drop this reference; that CPU's
+// hardware may still walk the user page tables, so they
+// go when it switches away.
 void
 freevm(pde_t *pgdir)
 {
@@ -287,8 +355,10 @@ freevm(pde_t *pgdir)
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
+  if(kunref((char*)pgdir) > 0)
+    return;
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -310,40 +380,273 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Map the pages of page table s between user addresses start
+// and end into page table d as well.  If cow is set, writable
+// pages become read-only and PTE_COW in both page tables, and
+// the first write to one makes a private copy (see cowcopy);
+// the caller must then flush s's stale TLB entries.
+int
+sharepages(pde_t *d, pde_t *s, uint start, uint end, int cow)
+{
+  pte_t *pte;
+  uint pa, i, flags;
+
+  for(i = start; i < end; i += PGSIZE){
+    // Pages not touched yet stay unmapped in d too.
+    if((pte = walkpgdir(s, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(!(*pte & PTE_P))
+      continue;
+    if(cow && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    pa = PTE_ADDR(*pte);
+    flags = PTE_FLAGS(*pte);
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+      return -1;
+    kref(P2V(pa));
+  }
+  return 0;
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child, sharing the parent's pages
+// copy-on-write.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
-      goto bad;
-    }
+  if(sharepages(d, pgdir, 0, sz, 1) < 0){
+    lcr3(rcr3());
+    freevm(d);
+    return 0;
   }
+  // The parent's mappings just lost PTE_W; flush its stale TLB entries.
+  lcr3(rcr3());
   return d;
+}
+
+// Give pgdir a private, writable copy of the copy-on-write
+// page at va.  If no one else shares the page any more, just
+// make it writable again.  Returns 0 on success, -1 if va is
+// not a copy-on-write page or memory ran out.
+static int
+cowcopy(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa, flags;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  pte = walkpgdir(pgdir, (void*)va, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(krefcount(P2V(pa)) > 1){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, P2V(pa), PGSIZE);
+    *pte = V2P(mem) | flags;
+    kfree(P2V(pa));
+  } else
+    *pte = pa | flags;
+  if(rcr3() == V2P(pgdir))
+    invlpg((void*)va);
+  return 0;
+}
+
+// Map a zeroed page at va for p, which has touched a
+// part of its heap that sbrk reserved but nothing has
+// allocated yet.  Returns 0 on success, -1 if va is outside
+// the process or memory ran out.
+static int
+zerofill(struct proc *p, uint va)
+{
+  char *mem;
+
+  if(va >= p->sz)
+    return -1;
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  if(mappages(p->pgdir, (char*)PGROUNDDOWN(va), PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  p->rss++;
+  return 0;
+}
+
+// Return the segment of p's program that has file data
+// in the page at va, or 0 if there is none.
+static struct execseg*
+findseg(struct proc *p, uint va)
+{
+  struct execseg *s;
+
+  for(s = p->seg; s < &p->seg[p->nseg]; s++)
+    if(va >= s->va && va < s->va + s->filesz)
+      return s;
+  return 0;
+}
+
+// Read the page at va of segment s from p's executable
+// into a new page and map it.  Caller must hold p->exe's lock.
+static int
+execpage(struct proc *p, struct execseg *s, uint va)
+{
+  char *mem;
+  uint n;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  n = s->va + s->filesz - va;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  if(readi(p->exe, mem, s->off + (va - s->va), n) != n){
+    kfree(mem);
+    return -1;
+  }
+  memset(mem + n, 0, PGSIZE - n);
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  p->rss++;
+  return 0;
+}
+
+// Page in the program page at va for p, along with up to
+// EXECAHEAD-1 following pages of the same segment that are
+// not resident yet.  Returns 0 on success, -1 on error.
+static int
+execfill(struct proc *p, struct execseg *s, uint va)
+{
+  pte_t *pte;
+  uint a;
+  int i, r;
+
+  va = PGROUNDDOWN(va);
+  ilock(p->exe);
+  r = execpage(p, s, va);
+  a = va + PGSIZE;
+  for(i = 1; r == 0 && i < EXECAHEAD && a < s->va + s->filesz; i++){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte && (*pte & PTE_P))
+      break;
+    if(execpage(p, s, a) < 0)
+      break;
+    a += PGSIZE;
+  }
+  iunlock(p->exe);
+  return r;
+}
+
+// Handle a page fault at address va taken by the current
+// process, in user mode or while the kernel was accessing
+// user memory on its behalf.  err is the hardware error code.
+// Returns 0 if the faulting access can be retried, -1 if it
+// was invalid.
+int
+pagefault(uint va, uint err)
+{
+  struct proc *curproc = myproc();
+
+  struct execseg *s;
+  struct vma *v;
+
+  if(curproc == 0 || va >= KERNBASE)
+    return -1;
+  if((err & FEC_PR) == 0){
+    if((v = findvma(curproc, va)) != 0)
+      return mmapfault(curproc, v, va, err);
+    if((s = findseg(curproc, va)) != 0)
+      return execfill(curproc, s, va);
+    return zerofill(curproc, va);
+  }
+  if(err & FEC_WR)
+    return cowcopy(curproc->pgdir, va);
+  return -1;
+}
 
-bad:
-  freevm(d);
+// Make sure the current process's user pages in [va, va+len)
+// are resident.  System calls do this to user buffers before
+// using them, because paging in from the executable sleeps
+// and so must not happen in a fault taken with a spinlock held.
+int
+faultin(uint va, uint len)
+{
+  struct proc *curproc = myproc();
+  pte_t *pte;
+  uint a;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    pte = walkpgdir(curproc->pgdir, (char*)a, 0);
+    if((pte == 0 || (*pte & PTE_P) == 0) && pagefault(a, 0) < 0)
+      return -1;
+  }
   return 0;
 }
 
+// Return 1 if the kernel may write to the current process's
+// user pages in [va, va+len), which faultin() has made
+// resident: they must be user pages that are writable or
+// copy-on-write.  Returns 0 otherwise.
+int
+writableuvm(uint va, uint len)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    pte = walkpgdir(myproc()->pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+      return 0;
+    if((*pte & (PTE_W|PTE_COW)) == 0)
+      return 0;
+  }
+  return 1;
+}
+
+// Count the pages mapped in pgdir between user addresses
+// start and end.
+int
+residentuvm(pde_t *pgdir, uint start, uint end)
+{
+  pte_t *pte;
+  uint a;
+  int n;
+
+  n = 0;
+  for(a = PGROUNDUP(start); a < end; a += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(!pte)
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    else if(*pte & PTE_P)
+      n++;
+  }
+  return n;
+}
+
+// Count the page table pages of pgdir's user half, plus the
+// page directory itself.  The kernel's page tables are shared
+// by all page directories and not counted.
+int
+ptpages(pde_t *pgdir)
+{
+  int i, n;
+
+  n = 1;
+  for(i = 0; i < PDX(KERNBASE); i++)
+    if(pgdir[i] & PTE_P)
+      n++;
+  return n;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -352,7 +655,7 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -367,10 +670,16 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    // The kernel writes through its own mapping of the page,
+    // so copy-on-write has to be broken by hand.
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_COW) && cowcopy(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;